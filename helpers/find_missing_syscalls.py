@@ -1,31 +1,38 @@
 import os
 import sys
-import re
 import subprocess
 
-def get_source():
-    dir_path = os.path.dirname(os.path.realpath(__file__))
-    setup_seccomp_path = os.path.join(dir_path, '../src/setup_seccomp.cpp')
-
-    with open(setup_seccomp_path) as f:
-        return f.read()
+# Usage: find_missing_syscalls.py [--seccomp-profile profile] command [args...]
+# Runs command under srun2 --syscall-profile, which lets every syscall go on and
+# reports ones outside of the profile, at nearly native speed (no ptrace).
 
-def get_saferun_syscalls():
-    src = get_source()
-    p = re.compile('ALLOW_SYSCALL\((.*)\)')
-    return p.findall(src)
+def get_srun2():
+    dir_path = os.path.dirname(os.path.realpath(__file__))
+    srun2_path = os.path.join(dir_path, '../srun2')
+    return srun2_path if os.path.exists(srun2_path) else 'srun2'
 
-def get_strace_output(args):
-    result = subprocess.run(['strace'] + args, stderr=subprocess.PIPE, encoding='utf-8')
+def get_profile_report(args):
+    srun2_args = ['--syscall-profile', '1', '-t', '60000', '-r', '120000']
+    if len(args) > 2 and args[0] == '--seccomp-profile':
+        srun2_args += args[:2]
+        args = args[2:]
+    result = subprocess.run([get_srun2()] + srun2_args + ['--'] + args, stderr=subprocess.PIPE, encoding='utf-8')
     return result.stderr
 
-def get_strace_syscalls(args):
-    report = get_strace_output(args)
-    lines = report.strip().split()
-    p = re.compile('([a-z0-9]*)\(.*')
-    return [m.group(1) for m in map(p.match, lines) if m is not None and m.group(1)]
+def get_missing_syscalls(args):
+    report = get_profile_report(args)
+    first = None
+    missing = []
+    for line in report.splitlines():
+        fields = line.split()
+        if fields and fields[0] == 'SRUN_SYSCALL_FIRST:' and fields[1] != 'none':
+            first = fields[1]
+        elif fields and fields[0] == 'SRUN_SYSCALL:':
+            missing.append((fields[1], int(fields[2])))
+    return first, missing
 
-saferun_syscalls = set(get_saferun_syscalls())
-strace_syscalls = set(get_strace_syscalls(sys.argv[1:]))
+first, missing = get_missing_syscalls(sys.argv[1:])
 print('--- Missing syscalls in saferun: ---')
-print('\n'.join(sorted(strace_syscalls - saferun_syscalls)))
+print('\n'.join('%-20s %d' % (name, hits) for name, hits in missing))
+if first:
+    print('--- First one, SV would be here: %s ---' % first)
@@ -0,0 +1,110 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "batch.h"
+#include "caller.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Manifest format, one test per line:
+ *   stdin_file stdout_file [per-test options]
+ *
+ * e.g. "tests/01 out/01 --time 3000 --mem 262144".
+ * "-" instead of a file keeps redirect given on the command line.
+ * Fields are separated by whitespace, there is no quoting.
+ * Empty lines and lines starting with '#' are skipped.
+ */
+
+#define BATCH_MAX_ARGS 64
+
+/* Splits line into argv of the test, @return argc or -1 on error */
+int parse_test_line(char *line, char **argv) {
+    const char *delim = " \t\r\n";
+    char *saveptr;
+    char *in = strtok_r(line, delim, &saveptr);
+    char *out = strtok_r(NULL, delim, &saveptr);
+    if (!in || !out)
+        return -1;
+
+    int argc = 0;
+    argv[argc++] = (char *) "srun2";
+    if (strcmp(in, "-")) {
+        argv[argc++] = (char *) "--redirect-stdin";
+        argv[argc++] = in;
+    }
+    if (strcmp(out, "-")) {
+        argv[argc++] = (char *) "--redirect-stdout";
+        argv[argc++] = out;
+    }
+
+    char *arg;
+    while ((arg = strtok_r(NULL, delim, &saveptr))) {
+        if (argc >= BATCH_MAX_ARGS)
+            return -1;
+        argv[argc++] = arg;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+/** Runs tests of manifest one by one. @return -1 on error */
+int run_batch(const char *manifest_path, bool stop_on_fail, test_handler_t handler) {
+    // we may be setuid root, manifest is read with permissions of the real caller
+    FILE *manifest = fopen_as_caller(manifest_path, "re");
+    if (!manifest) {
+        SYSERROR("Can't open manifest ""%s""", manifest_path);
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_no = 0, ret = 0;
+
+    while (getline(&line, &line_size, manifest) != -1) {
+        ++line_no;
+        char *start = line + strspn(line, " \t\r\n");
+        if (*start == '\0' || *start == '#')
+            continue;
+
+        char *argv[BATCH_MAX_ARGS + 1];
+        int argc = parse_test_line(start, argv);
+        if (argc == -1) {
+            ERROR("Malformed line %d of manifest", line_no);
+            ret = -1;
+            break;
+        }
+
+        int result = handler(argc, argv);
+        if (result == -1) {
+            ERROR("Can't run test from line %d of manifest", line_no);
+            ret = -1;
+            break;
+        }
+
+        if (stop_on_fail && result != 0) {
+            DEBUG("stopping batch after line %d", line_no);
+            break;
+        }
+    }
+
+    free(line);
+    fclose(manifest);
+    return ret;
+}
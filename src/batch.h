@@ -0,0 +1,29 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+/**
+ * Runs one test of the batch and prints its report.
+ * @param argv options of the test (redirects and per-test limits), argv[0] is a dummy program name
+ * @return result_t of the run, or -1 if test can't be run
+ */
+typedef int (*test_handler_t)(int argc, char **argv);
+
+int run_batch(const char *manifest_path, bool stop_on_fail, test_handler_t handler);
+
+#endif /* BATCH_H_ */
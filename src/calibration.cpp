@@ -0,0 +1,242 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "calibration.h"
+#include "caller.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Speed of this machine relative to the reference one, so a time limit means the same on
+ * every node of a judging fleet. Three kernels are timed by cpu clock of the thread, best of
+ * CALIBRATION_REPEATS:
+ *   alu    - dependent chain of integer operations, like PROFILING_do_some_stuff;
+ *   chase  - pointer chasing over one random cycle much bigger than caches, memory latency;
+ *   stream - sequential sum over the same buffer, memory bandwidth.
+ * Speed is the geometric mean of reference cost / measured cost, above 1 on faster machines.
+ * Limits are given for the reference machine and runs get them divided by speed, times of
+ * the run multiplied by it are normalized, i.e. what they would be on the reference machine.
+ *
+ * Result is kept in file as "speed alu chase stream", costs are in ns per step.
+ */
+
+#define CALIBRATION_REPEATS 3
+#define CALIBRATION_ALU_STEPS (32L*1024*1024)
+#define CALIBRATION_CELLS (16L*1024*1024) /**< 64 Mbytes of uint32_t, more than last level cache */
+#define CALIBRATION_CHASE_STEPS (1024L*1024)
+#define CALIBRATION_STREAM_PASSES 8
+
+/* Costs on the reference machine, ns per step */
+#define REFERENCE_ALU 2.8
+#define REFERENCE_CHASE 150.0
+#define REFERENCE_STREAM 0.12
+
+/* Speed file written by hand or by another build can't be that far off */
+#define CALIBRATION_MIN_SPEED 0.05
+#define CALIBRATION_MAX_SPEED 20.0
+
+struct calibration_t {
+    double alu;
+    double chase;
+    double stream;
+    double speed; /**< 0 if time limits are not normalized */
+};
+
+static calibration_t calibration = {0, 0, 0, 0};
+static volatile uint64_t sink; /**< results of kernels, so compiler can't throw them away */
+
+long long get_thread_time_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+uint64_t xorshift(uint64_t *x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+uint64_t alu_kernel(long steps) {
+    uint64_t x = 88172645463325252ULL, s = 0;
+    for (long i = 0; i < steps; ++i)
+        s += xorshift(&x) * 0x9E3779B97F4A7C15ULL + (s >> 3);
+    return s;
+}
+
+/* Sattolo's shuffle makes one cycle through all cells, every load depends on the previous one and misses */
+void make_cycle(uint32_t *cells, long count) {
+    uint64_t x = 2463534242ULL;
+    for (long i = 0; i < count; ++i)
+        cells[i] = i;
+    for (long i = count - 1; i > 0; --i) {
+        long j = xorshift(&x) % i;
+        uint32_t t = cells[i];
+        cells[i] = cells[j];
+        cells[j] = t;
+    }
+}
+
+uint64_t chase_kernel(const uint32_t *cells, long steps) {
+    uint32_t p = 0;
+    for (long i = 0; i < steps; ++i)
+        p = cells[p];
+    return p;
+}
+
+uint64_t stream_kernel(const uint32_t *cells, long count, int passes) {
+    uint64_t s = 0;
+    for (int pass = 0; pass < passes; ++pass)
+        for (long i = 0; i < count; ++i)
+            s += cells[i];
+    return s;
+}
+
+/** @return best time of the kernel in ns per step */
+double time_kernel(int kernel, const uint32_t *cells) {
+    long long best = -1;
+    long steps = 0;
+    for (int i = 0; i < CALIBRATION_REPEATS; ++i) {
+        long long start = get_thread_time_ns();
+        if (kernel == 0) {
+            sink += alu_kernel(CALIBRATION_ALU_STEPS);
+            steps = CALIBRATION_ALU_STEPS;
+        } else if (kernel == 1) {
+            sink += chase_kernel(cells, CALIBRATION_CHASE_STEPS);
+            steps = CALIBRATION_CHASE_STEPS;
+        } else {
+            sink += stream_kernel(cells, CALIBRATION_CELLS, CALIBRATION_STREAM_PASSES);
+            steps = CALIBRATION_CELLS * CALIBRATION_STREAM_PASSES;
+        }
+        long long time = get_thread_time_ns() - start;
+        if (best == -1 || time < best)
+            best = time;
+    }
+    return (double) best / steps;
+}
+
+/** Runs the kernels, takes about a second. @return -1 if buffer can't be allocated */
+int calibrate() {
+    uint32_t *cells = (uint32_t *) malloc(CALIBRATION_CELLS * sizeof(uint32_t));
+    if (!cells) {
+        ERROR("Can't allocate %ld Mbytes for calibration", CALIBRATION_CELLS * sizeof(uint32_t) / 1024 / 1024);
+        return -1;
+    }
+    make_cycle(cells, CALIBRATION_CELLS);
+
+    calibration.alu = time_kernel(0, cells);
+    calibration.chase = time_kernel(1, cells);
+    calibration.stream = time_kernel(2, cells);
+    free(cells);
+
+    calibration.speed = cbrt(REFERENCE_ALU / calibration.alu * REFERENCE_CHASE / calibration.chase
+            * REFERENCE_STREAM / calibration.stream);
+    return 0;
+}
+
+/** @return -1 if there is no valid calibration in file */
+int calibration_load(const char *path) {
+    FILE *f = fopen_as_caller(path, "re");
+    if (!f)
+        return -1;
+
+    calibration_t c;
+    int n = fscanf(f, "%lf %lf %lf %lf", &c.speed, &c.alu, &c.chase, &c.stream);
+    fclose(f);
+    if (n != 4 || !(c.speed >= CALIBRATION_MIN_SPEED && c.speed <= CALIBRATION_MAX_SPEED)) {
+        WARN("Calibration in %s is invalid, machine is calibrated again", path);
+        return -1;
+    }
+    calibration = c;
+    return 0;
+}
+
+/* Written to temporary file and renamed as the caller, daemons of the same node may start at once */
+void calibration_save(const char *path) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+
+    uid_t euid;
+    if (!drop_euid(&euid)) {
+        SYSWARN("can't save calibration to %s", path);
+        return;
+    }
+    FILE *f = fopen(tmp, "we");
+    bool ok = f && fprintf(f, "%.4f %.3f %.3f %.4f\n", calibration.speed, calibration.alu,
+            calibration.chase, calibration.stream) > 0;
+    if (f && fclose(f) != 0)
+        ok = false;
+    if (!ok || rename(tmp, path) == -1) {
+        SYSWARN("can't save calibration to %s", path);
+        unlink(tmp);
+    }
+    restore_euid(euid);
+}
+
+/**
+ * Takes speed of this machine from file, calibrates and saves it there if there is none.
+ * With force it is calibrated anyway, path may be NULL then. @return -1 on error
+ */
+int calibration_init(const char *path, bool force) {
+    if (!force && path && calibration_load(path) == 0) {
+        DEBUG("speed %.3f is loaded from %s", calibration.speed, path);
+        return 0;
+    }
+
+    if (calibrate() == -1)
+        return -1;
+    if (!(calibration.speed >= CALIBRATION_MIN_SPEED && calibration.speed <= CALIBRATION_MAX_SPEED)) {
+        ERROR("Calibration failed, speed %.3f is out of range", calibration.speed);
+        calibration.speed = 0;
+        return -1;
+    }
+    INFO("Speed of this machine is %.3f (alu %.3f ns, chase %.3f ns, stream %.4f ns)",
+            calibration.speed, calibration.alu, calibration.chase, calibration.stream);
+    if (path)
+        calibration_save(path);
+    return 0;
+}
+
+bool calibration_enabled() {
+    return calibration.speed > 0;
+}
+
+/** @return limit of the reference machine in ms as it is on this one */
+long calibration_scale(long ms) {
+    if (!calibration_enabled())
+        return ms;
+    return lround(ms / calibration.speed);
+}
+
+/** @return time measured on this machine in ms as it would be on the reference one */
+long calibration_normalize(long ms) {
+    if (!calibration_enabled())
+        return ms;
+    return lround(ms * calibration.speed);
+}
+
+void calibration_print(FILE *stream) {
+    fprintf(stream, "SRUN_CALIBRATION: %.4f %.3f %.3f %.4f\n",
+            calibration.speed, calibration.alu, calibration.chase, calibration.stream);
+}
@@ -0,0 +1,28 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+
+#include <stdio.h>
+
+int calibration_init(const char *path, bool force);
+bool calibration_enabled();
+long calibration_scale(long ms);
+long calibration_normalize(long ms);
+void calibration_print(FILE *stream);
+
+#endif /* CALIBRATION_H_ */
@@ -0,0 +1,59 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "caller.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/** Saves effective uid to euid and takes the real one. @return false on error */
+bool drop_euid(uid_t *euid) {
+    *euid = geteuid();
+    return seteuid(getuid()) == 0;
+}
+
+/* Aborts on failure, we must not go on with uid of the caller */
+void restore_euid(uid_t euid) {
+    int saved_errno = errno;
+    if (seteuid(euid) == -1) {
+        SYSERROR("can't restore effective uid");
+        abort();
+    }
+    errno = saved_errno;
+}
+
+/** Files are created with mode 0666 (minus umask). @return -1 on error */
+int open_as_caller(const char *path, int flags) {
+    uid_t euid;
+    if (!drop_euid(&euid))
+        return -1;
+    int fd = open(path, flags | O_CLOEXEC, 0666);
+    restore_euid(euid);
+    return fd;
+}
+
+/** @return NULL on error */
+FILE *fopen_as_caller(const char *path, const char *mode) {
+    uid_t euid;
+    if (!drop_euid(&euid))
+        return NULL;
+    FILE *f = fopen(path, mode);
+    restore_euid(euid);
+    return f;
+}
@@ -0,0 +1,33 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef CALLER_H_
+#define CALLER_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * srun2 is setuid root, files named by the caller are accessed with its permissions.
+ * Effective uid is switched to the real one and back, errno of the access is kept.
+ */
+bool drop_euid(uid_t *euid);
+void restore_euid(uid_t euid);
+int open_as_caller(const char *path, int flags);
+FILE *fopen_as_caller(const char *path, const char *mode);
+
+#endif /* CALLER_H_ */
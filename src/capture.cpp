@@ -0,0 +1,235 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "capture.h"
+#include "checker.h"
+#include "spawn.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define CAPTURE_PIPE_SIZE (1024*1024)
+#define CAPTURE_CHUNK (64*1024)
+/* Chunks moved in one drain, a program that keeps the pipe full can't keep us from timers */
+#define CAPTURE_MAX_CHUNKS (CAPTURE_PIPE_SIZE / CAPTURE_CHUNK)
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/*
+ * With --capture stdout and stderr of the program are pipes, hypervisor moves data from them
+ * to destination: file of --redirect-*, stream of srun2 itself if there is no redirect, or /dev/null.
+ * So output is counted as it comes and the run is OL as soon as --output-limit is exceeded,
+ * nothing beyond the limit is written.
+ *
+ * Data goes with splice() without copying to userspace, unless it is hashed (--output-hash),
+ * checked (--expect) or destination can't splice. FNV-1a is used, so clients can hash expected output the same way.
+ *
+ * Destination files are opened by srun2 with permissions of the real caller, see open_in_jail().
+ * Stderr redirected to stdout shares its pipe.
+ */
+
+void init_capture(capture_t *c) {
+    c->read_fd = -1;
+    c->write_fd = -1;
+    c->dest_fd = -1;
+    c->use_splice = true;
+}
+
+void capture_init(process_t *proc) {
+    init_capture(&proc->out);
+    init_capture(&proc->err);
+    checker_init(&proc->checker);
+}
+
+int open_capture(capture_t *c, const jail_t *jail, const char *redirect, int own_fd) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        SYSERROR("can't create pipe for output");
+        return -1;
+    }
+    c->read_fd = fds[0];
+    c->write_fd = fds[1];
+
+    // child writes to its end as usual, only our end doesn't block
+    if (fcntl(c->read_fd, F_SETFL, O_NONBLOCK) == -1) {
+        SYSERROR("can't make output pipe non-blocking");
+        return -1;
+    }
+    if (fcntl(c->read_fd, F_SETPIPE_SZ, CAPTURE_PIPE_SIZE) == -1) {
+        TRACE("can't enlarge output pipe: %s", strerror(errno)); //fewer wakeups, not critical
+    }
+
+    if (!redirect)
+        c->dest_fd = fcntl(own_fd, F_DUPFD_CLOEXEC, 3);
+    else if (!strcmp(redirect, "null"))
+        c->dest_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    else
+        c->dest_fd = open_in_jail(jail, redirect, O_WRONLY | O_CREAT | O_TRUNC);
+
+    if (c->dest_fd == -1) {
+        SYSERROR("Can't open %s for output", redirect ? redirect : "own stream");
+        return -1;
+    }
+    return 0;
+}
+
+/** Creates pipes and opens destinations before spawn. @return -1 on error */
+int capture_prepare(process_t *proc) {
+    if (!proc->capture)
+        return 0;
+
+    proc->stats.output = 0;
+    proc->stats.output_hash = FNV_OFFSET_BASIS;
+    proc->stats.mismatch = -1;
+    if (proc->expect && checker_open(&proc->checker, proc->expect, proc->expect_exact) == -1)
+        return -1;
+
+    if (open_capture(&proc->out, &proc->jail, proc->redirect_stdout, STDOUT_FILENO) == -1)
+        return -1;
+
+    const char *err = proc->redirect_stderr;
+    if (err && (!strcmp(err, "stdout") || !strcmp(err, "null")))
+        return 0; //done by the child as usual
+    return open_capture(&proc->err, &proc->jail, err, STDERR_FILENO);
+}
+
+void redirect_to_pipe(int fd, int write_fd) {
+    if (write_fd == -1)
+        return;
+    if (dup2(write_fd, fd) == -1) {
+        SYSERROR("can't redirect fd %d to output pipe", fd);
+        abort();
+    }
+}
+
+/* Called in child instead of redirecting stdout and stderr to files */
+void capture_enter(process_t *proc) {
+    redirect_to_pipe(STDOUT_FILENO, proc->out.write_fd);
+    redirect_to_pipe(STDERR_FILENO, proc->err.write_fd);
+}
+
+/* Parent doesn't need child's ends anymore, pipes get EOF when all processes of the run close them */
+void capture_started(process_t *proc) {
+    if (proc->out.write_fd != -1)
+        close(proc->out.write_fd);
+    if (proc->err.write_fd != -1)
+        close(proc->err.write_fd);
+    proc->out.write_fd = proc->err.write_fd = -1;
+}
+
+void hash_output(unsigned long long *hash, const char *buf, size_t len) {
+    unsigned long long h = *hash;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char) buf[i];
+        h *= FNV_PRIME;
+    }
+    *hash = h;
+}
+
+bool write_full(int fd, const char *buf, size_t len) {
+    while (len) {
+        ssize_t ret = write(fd, buf, len);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        buf += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+/* Moves at most len bytes. @return bytes read from pipe, 0 on EOF, -1 if pipe is empty */
+ssize_t move_output(process_t *proc, capture_t *c, size_t len) {
+    bool hash = proc->output_hash && c == &proc->out;
+    bool check = proc->checker.expected && c == &proc->out;
+    if (c->use_splice && !hash && !check) {
+        ssize_t ret = splice(c->read_fd, NULL, c->dest_fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (ret != -1 || errno != EINVAL)
+            return ret;
+        c->use_splice = false;
+    }
+
+    char buf[CAPTURE_CHUNK];
+    ssize_t ret = read(c->read_fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+    if (ret <= 0)
+        return ret;
+    if (hash)
+        hash_output(&proc->stats.output_hash, buf, ret);
+    if (check) {
+        checker_feed(&proc->checker, buf, ret);
+        if (proc->expect_stop && proc->checker.mismatch != -1 && proc->stats.result == _OK)
+            proc->stats.result = _WA;
+    }
+    if (!write_full(c->dest_fd, buf, ret))
+        SYSWARN("can't write output"); //still counted, program's output is what is limited
+    return ret;
+}
+
+/*
+ * Drains what is in the pipe now, at most CAPTURE_MAX_CHUNKS, level-triggered epoll brings us back
+ * for the rest. Output beyond the limit isn't read: it is OL at its first byte and the run is killed.
+ * @return false if the pipe is closed by all writers, broken or over the limit, it shouldn't be polled anymore
+ */
+bool capture_drain(process_t *proc, capture_t *c) {
+    long long limit = proc->limits.output > 0 ? proc->limits.output * 1024LL : LLONG_MAX;
+    for (int i = 0; i < CAPTURE_MAX_CHUNKS; ++i) {
+        long long left = limit - proc->stats.output;
+        ssize_t ret;
+        if (left > 0) {
+            ret = move_output(proc, c, left < CAPTURE_CHUNK ? left : CAPTURE_CHUNK);
+            if (ret > 0)
+                proc->stats.output += ret;
+        } else {
+            char byte;
+            ret = read(c->read_fd, &byte, 1);
+            if (ret > 0) {
+                if (proc->stats.result == _OK)
+                    proc->stats.result = _OL;
+                return false;
+            }
+        }
+
+        if (ret == 0)
+            return false;
+        if (ret == -1 && errno != EINTR) {
+            if (errno == EAGAIN)
+                return true;
+            SYSWARN("can't drain output");
+            return false;
+        }
+    }
+    return true;
+}
+
+void close_capture(capture_t *c) {
+    if (c->read_fd != -1) close(c->read_fd);
+    if (c->write_fd != -1) close(c->write_fd);
+    if (c->dest_fd != -1) close(c->dest_fd);
+    init_capture(c);
+}
+
+void capture_release(process_t *proc) {
+    close_capture(&proc->out);
+    close_capture(&proc->err);
+    checker_close(&proc->checker);
+}
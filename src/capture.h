@@ -0,0 +1,29 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include "process.h"
+
+void capture_init(process_t *proc);
+int capture_prepare(process_t *proc);
+void capture_enter(process_t *proc);
+void capture_started(process_t *proc);
+bool capture_drain(process_t *proc, capture_t *c);
+void capture_release(process_t *proc);
+
+#endif /* CAPTURE_H_ */
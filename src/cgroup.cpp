@@ -0,0 +1,298 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "cgroup.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/inotify.h>
+
+/* Reading from cgroup files constants */
+#define CGROUP_READ_BUF_SIZE 512
+/* How long destroy waits for killed processes to exit, in milliseconds */
+#define CGROUP_EMPTY_TIMEOUT 1000
+
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+
+/*
+ * Every run gets its own leaf cgroup under the root given by --cgroup:
+ *   memory.max, memory.swap.max - kernel enforces memory limit, no sampling gaps;
+ *   memory.events               - oom_kill counter, inotify tells us when it changes;
+ *   cpu.stat, memory.peak       - exact usage for the whole run;
+ *   pids.peak                   - peak number of tasks, if pids controller is enabled;
+ *   cgroup.kill                 - kills all processes at once, none can escape by forking.
+ *
+ * Root must be a cgroup v2 directory delegated to srun2 (no processes inside),
+ * memory controller is enabled in its subtree_control if needed.
+ * We may be setuid root, so root must be delegated to the real caller, i.e. owned by it.
+ */
+
+void cgroup_init(cgroup_t *cg) {
+    cg->path = NULL;
+    cg->procs_fd = -1;
+    cg->stat_fd = -1;
+    cg->peak_fd = -1;
+    cg->events_fd = -1;
+    cg->notify_fd = -1;
+    cg->pids_fd = -1;
+    cg->kill_fd = -1;
+}
+
+int open_cgroup_file(const char *dir, const char *filename, int flags) {
+    char full_fname[PATH_MAX];
+    snprintf(full_fname, PATH_MAX, "%s/%s", dir, filename);
+    return open(full_fname, flags | O_CLOEXEC);
+}
+
+int write_cgroup_file(const char *dir, const char *filename, const char *value) {
+    int fd = open_cgroup_file(dir, filename, O_WRONLY);
+    if (fd == -1)
+        return -1;
+
+    int len = strlen(value);
+    int ret = (write(fd, value, len) == len) ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+/* Whole file with one pread() from offset 0, like in read_from_proc */
+int read_cgroup_fd(int fd, char *buf, const size_t buf_len) {
+    if (fd == -1)
+        return -1;
+
+    ssize_t len = pread(fd, buf, buf_len - 1, 0);
+    if (len < 0)
+        return -1;
+    buf[len] = '\0';
+    return 0;
+}
+
+/* Parses "key value" lines of flat keyed files like cpu.stat and memory.events */
+long long read_cgroup_key(int fd, const char *key) {
+    char buf[CGROUP_READ_BUF_SIZE];
+    if (read_cgroup_fd(fd, buf, CGROUP_READ_BUF_SIZE))
+        return -1;
+
+    int key_len = strlen(key);
+    char *line = buf;
+    while (line && *line) {
+        if (!strncmp(line, key, key_len) && line[key_len] == ' ')
+            return atoll(line + key_len + 1);
+        line = strchr(line, '\n');
+        if (line) ++line;
+    }
+    return -1;
+}
+
+/* Root given by the caller must be cgroup v2 directory delegated to it, we write there as root */
+bool check_cgroup_root(const char *root) {
+    struct statfs fs;
+    struct stat st;
+    if (statfs(root, &fs) == -1 || stat(root, &st) == -1) {
+        SYSERROR("can't access cgroup %s", root);
+        return false;
+    }
+    if (fs.f_type != CGROUP2_SUPER_MAGIC || !S_ISDIR(st.st_mode)) {
+        ERROR("%s is not a cgroup v2 directory", root);
+        return false;
+    }
+    if (getuid() != 0 && st.st_uid != getuid()) {
+        ERROR("cgroup %s is not delegated to the caller", root);
+        return false;
+    }
+    return true;
+}
+
+int cgroup_create(cgroup_t *cg, const char *root, const limits_t *limits) {
+    static int counter = 0;
+    char buf[PATH_MAX];
+
+    if (!check_cgroup_root(root))
+        return -1;
+
+    // Not an error, may be already enabled or controlled by someone else
+    if (write_cgroup_file(root, "cgroup.subtree_control", "+memory +cpu +pids")) {
+        TRACE("can't enable controllers in %s: %s", root, strerror(errno));
+    }
+
+    snprintf(buf, PATH_MAX, "%s/srun2-%d-%d", root, getpid(), counter++);
+    if (mkdir(buf, 0700) == -1) {
+        SYSERROR("can't create cgroup %s", buf);
+        return -1;
+    }
+    cg->path = strdup(buf);
+
+    snprintf(buf, PATH_MAX, "%lld", limits->mem * 1024LL);
+    if (write_cgroup_file(cg->path, "memory.max", buf)) {
+        SYSERROR("can't set memory.max, is memory controller enabled in %s?", root);
+        goto err;
+    }
+    if (write_cgroup_file(cg->path, "memory.swap.max", "0"))
+        SYSWARN("can't set memory.swap.max"); //not a critical error, may be no swap at all
+    if (write_cgroup_file(cg->path, "memory.oom.group", "1"))
+        SYSWARN("can't set memory.oom.group");
+
+    cg->procs_fd = open_cgroup_file(cg->path, "cgroup.procs", O_WRONLY);
+    cg->stat_fd = open_cgroup_file(cg->path, "cpu.stat", O_RDONLY);
+    cg->events_fd = open_cgroup_file(cg->path, "memory.events", O_RDONLY);
+    cg->peak_fd = open_cgroup_file(cg->path, "memory.peak", O_RDONLY);
+    if (cg->peak_fd == -1) // before Linux 5.19
+        cg->peak_fd = open_cgroup_file(cg->path, "memory.current", O_RDONLY);
+
+    // not critical, tasks are counted from /proc then
+    cg->pids_fd = open_cgroup_file(cg->path, "pids.peak", O_RDONLY);
+    if (cg->pids_fd == -1) // before Linux 6.13 or no pids controller
+        cg->pids_fd = open_cgroup_file(cg->path, "pids.current", O_RDONLY);
+
+    cg->kill_fd = open_cgroup_file(cg->path, "cgroup.kill", O_WRONLY);
+
+    if (cg->procs_fd == -1 || cg->stat_fd == -1 || cg->events_fd == -1 || cg->peak_fd == -1) {
+        SYSERROR("can't open files of cgroup %s", cg->path);
+        goto err;
+    }
+
+    cg->notify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    snprintf(buf, PATH_MAX, "%s/memory.events", cg->path);
+    if (cg->notify_fd == -1 || inotify_add_watch(cg->notify_fd, buf, IN_MODIFY) == -1) {
+        SYSWARN("can't watch memory.events, oom will be noticed only when sampling");
+        if (cg->notify_fd != -1)
+            close(cg->notify_fd);
+        cg->notify_fd = -1;
+    }
+
+    DEBUG("created cgroup %s", cg->path);
+    return 0;
+
+err:
+    cgroup_destroy(cg);
+    return -1;
+}
+
+/* Called in child, moves it into the leaf cgroup */
+void cgroup_enter(cgroup_t *cg) {
+    if (!cg->path)
+        return;
+
+    // "0" means the writing process
+    if (write(cg->procs_fd, "0", 1) != 1) {
+        SYSERROR("can't move process to cgroup %s", cg->path);
+        abort();
+    }
+    close(cg->procs_fd);
+}
+
+/* Called in parent, moves already running process into the leaf cgroup */
+int cgroup_attach(cgroup_t *cg, pid_t pid) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%d", pid);
+    if (write(cg->procs_fd, buf, len) != len) {
+        SYSERROR("can't move process %d to cgroup %s", pid, cg->path);
+        return -1;
+    }
+    return 0;
+}
+
+/** Kills all processes in cgroup. @return -1 if cgroup.kill is not supported */
+int cgroup_kill(cgroup_t *cg) {
+    if (cg->kill_fd == -1)
+        return -1;
+    if (write(cg->kill_fd, "1", 1) != 1) {
+        SYSWARN("can't kill cgroup %s", cg->path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Kernel modifies cgroup.events when the last process leaves, poll() reports it as POLLPRI */
+void wait_cgroup_empty(cgroup_t *cg) {
+    int fd = open_cgroup_file(cg->path, "cgroup.events", O_RDONLY);
+    if (fd == -1)
+        return;
+
+    while (read_cgroup_key(fd, "populated") > 0) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLPRI;
+        if (poll(&pfd, 1, CGROUP_EMPTY_TIMEOUT) <= 0) {
+            WARN("Processes of cgroup %s don't exit", cg->path);
+            break;
+        }
+    }
+    close(fd);
+}
+
+/* Leftover processes of the run are killed, cgroup can't be removed with them */
+void cgroup_destroy(cgroup_t *cg) {
+    if (cg->path && cgroup_kill(cg) == 0)
+        wait_cgroup_empty(cg);
+
+    if (cg->procs_fd != -1) close(cg->procs_fd);
+    if (cg->stat_fd != -1) close(cg->stat_fd);
+    if (cg->peak_fd != -1) close(cg->peak_fd);
+    if (cg->events_fd != -1) close(cg->events_fd);
+    if (cg->notify_fd != -1) close(cg->notify_fd);
+    if (cg->pids_fd != -1) close(cg->pids_fd);
+    if (cg->kill_fd != -1) close(cg->kill_fd);
+
+    if (cg->path && rmdir(cg->path) == -1)
+        SYSWARN("can't remove cgroup %s", cg->path);
+
+    free(cg->path);
+    cgroup_init(cg);
+}
+
+/** @return user+system time of all processes in cgroup in milliseconds */
+long cgroup_get_time(cgroup_t *cg) {
+    long long usec = read_cgroup_key(cg->stat_fd, "usage_usec");
+    return usec < 0 ? 0 : usec / 1000;
+}
+
+/** @return peak memory usage of cgroup in Kbytes */
+long cgroup_get_mem(cgroup_t *cg) {
+    char buf[CGROUP_READ_BUF_SIZE];
+    if (read_cgroup_fd(cg->peak_fd, buf, CGROUP_READ_BUF_SIZE))
+        return 0;
+    return atoll(buf) / 1024;
+}
+
+/** @return peak (or current on older kernels) number of tasks in cgroup, -1 if unknown */
+long cgroup_get_tasks(cgroup_t *cg) {
+    char buf[CGROUP_READ_BUF_SIZE];
+    if (read_cgroup_fd(cg->pids_fd, buf, CGROUP_READ_BUF_SIZE))
+        return -1;
+    return atol(buf);
+}
+
+bool cgroup_oom_killed(cgroup_t *cg) {
+    return read_cgroup_key(cg->events_fd, "oom_kill") > 0;
+}
+
+/* Drains pending inotify events, so notify_fd stops being readable */
+void cgroup_consume_events(cgroup_t *cg) {
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+    while (read(cg->notify_fd, buf, sizeof(buf)) > 0)
+        ;
+}
@@ -0,0 +1,35 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef CGROUP_H_
+#define CGROUP_H_
+
+#include "process.h"
+
+void cgroup_init(cgroup_t *cg);
+int cgroup_create(cgroup_t *cg, const char *root, const limits_t *limits);
+void cgroup_enter(cgroup_t *cg);
+int cgroup_attach(cgroup_t *cg, pid_t pid);
+int cgroup_kill(cgroup_t *cg);
+void cgroup_destroy(cgroup_t *cg);
+
+long cgroup_get_time(cgroup_t *cg);
+long cgroup_get_mem(cgroup_t *cg);
+long cgroup_get_tasks(cgroup_t *cg);
+bool cgroup_oom_killed(cgroup_t *cg);
+void cgroup_consume_events(cgroup_t *cg);
+
+#endif /* CGROUP_H_ */
@@ -0,0 +1,176 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "checker.h"
+#include "caller.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CHECKER_BLOCK 64
+
+/*
+ * Checks stdout against expected answer as it comes out of the pipe, without a checker process
+ * and without reading the output again. Expected answer is mmapped.
+ *
+ * Tokens mode: output and answer are the same sequence of tokens separated by any whitespace.
+ * Most of the time output is byte by byte the same as the answer, so identical bytes are skipped
+ * with memcmp() a block at a time, whatever they are. Bytes that differ are compared token-wise,
+ * which is always consistent with skipping: identical bytes change token state the same way.
+ *
+ * Mismatch offset is the offset in output of the first byte that can't be matched,
+ * or size of the output if it ends too early.
+ */
+
+static const char empty_answer[1] = "";
+
+static bool is_space(unsigned char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+void checker_init(checker_t *checker) {
+    checker->expected = NULL;
+    checker->size = 0;
+    checker->pos = 0;
+    checker->offset = 0;
+    checker->mismatch = -1;
+    checker->in_token = false;
+    checker->exact = false;
+}
+
+/** Maps expected answer, it is opened with permissions of the real caller. @return -1 on error */
+int checker_open(checker_t *checker, const char *filename, bool exact) {
+    checker_init(checker);
+    checker->exact = exact;
+
+    int fd = open_as_caller(filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        SYSERROR("Can't open expected answer %s", filename);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    checker->size = st.st_size;
+    if (checker->size == 0) {
+        checker->expected = empty_answer; //empty mapping is not allowed
+    } else {
+        void *map = mmap(NULL, checker->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            SYSERROR("can't map expected answer %s", filename);
+            close(fd);
+            return -1;
+        }
+        madvise(map, checker->size, MADV_SEQUENTIAL);
+        checker->expected = (const char *) map;
+    }
+    close(fd);
+    return 0;
+}
+
+/* Length of common prefix of a and b, at most len */
+size_t common_prefix(const char *a, const char *b, size_t len) {
+    size_t i = 0;
+    while (i + CHECKER_BLOCK <= len && !memcmp(a + i, b + i, CHECKER_BLOCK))
+        i += CHECKER_BLOCK;
+    while (i < len && a[i] == b[i])
+        ++i;
+    return i;
+}
+
+/* @return index in buf of the first byte that doesn't match, len if all do */
+size_t feed_exact(checker_t *checker, const char *buf, size_t len) {
+    size_t left = checker->size - checker->pos;
+    size_t n = len < left ? len : left;
+    size_t same = common_prefix(buf, checker->expected + checker->pos, n);
+    checker->pos += same;
+    return same;
+}
+
+size_t feed_tokens(checker_t *checker, const char *buf, size_t len) {
+    const char *expected = checker->expected;
+    size_t size = checker->size, pos = checker->pos, i = 0;
+    bool in_token = checker->in_token;
+
+    while (i < len) {
+        size_t left = size - pos;
+        size_t same = common_prefix(buf + i, expected + pos, len - i < left ? len - i : left);
+        if (same) {
+            i += same;
+            pos += same;
+            in_token = !is_space(buf[i - 1]);
+            continue;
+        }
+
+        unsigned char c = buf[i];
+        if (is_space(c)) {
+            if (in_token && pos < size && !is_space(expected[pos]))
+                break; //token of output is shorter
+            in_token = false;
+            while (i < len && is_space(buf[i]))
+                ++i;
+            continue;
+        }
+
+        if (!in_token)
+            while (pos < size && is_space(expected[pos]))
+                ++pos;
+        if (pos == size || expected[pos] != c)
+            break;
+        ++pos;
+        ++i;
+        in_token = true;
+    }
+
+    checker->pos = pos;
+    checker->in_token = in_token;
+    return i;
+}
+
+/* Next part of output */
+void checker_feed(checker_t *checker, const char *buf, size_t len) {
+    if (checker->expected && checker->mismatch == -1) {
+        size_t matched = checker->exact ? feed_exact(checker, buf, len) : feed_tokens(checker, buf, len);
+        if (matched < len)
+            checker->mismatch = checker->offset + matched;
+    }
+    checker->offset += len;
+}
+
+/* Output has ended, the rest of the answer must be whitespace in tokens mode or nothing in exact one */
+void checker_finish(checker_t *checker) {
+    if (!checker->expected || checker->mismatch != -1)
+        return;
+
+    size_t pos = checker->pos;
+    if (!checker->exact)
+        while (pos < checker->size && is_space(checker->expected[pos]))
+            ++pos;
+    if (pos < checker->size)
+        checker->mismatch = checker->offset;
+}
+
+void checker_close(checker_t *checker) {
+    if (checker->expected && checker->expected != empty_answer)
+        munmap((void *) checker->expected, checker->size);
+    checker_init(checker);
+}
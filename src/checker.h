@@ -0,0 +1,28 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef CHECKER_H_
+#define CHECKER_H_
+
+#include "process.h"
+
+void checker_init(checker_t *checker);
+int checker_open(checker_t *checker, const char *filename, bool exact);
+void checker_feed(checker_t *checker, const char *buf, size_t len);
+void checker_finish(checker_t *checker);
+void checker_close(checker_t *checker);
+
+#endif /* CHECKER_H_ */
@@ -15,19 +15,34 @@
  */
 
 #include "process.h"
+#include "hypervisor.h"
+#include "cgroup.h"
+#include "syscall_profile.h"
+#include "process_tree.h"
+#include "capture.h"
+#include "checker.h"
+#include "mount_jail.h"
+#include "perf.h"
 #include "log.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <signal.h>
 
-/* in usecs */
-#define HYPERVISOR_DELAY 25*1000
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
 
 /* Reading from proc constants */
 #define PROC_FILENAME_MAX_LEN 50
@@ -35,13 +50,18 @@
 
 /*Timeval to milliseconds */
 #define TV_TO_MSEC(a) ((a).tv_sec * 1000 + (a).tv_usec / 1000)
+/*Timespec to milliseconds */
+#define TS_TO_MSEC(a) ((a).tv_sec * 1000 + (a).tv_nsec / 1000000)
 
-/** @return real time in milliseconds */
+/* Kbytes, large mappings are aligned to huge pages */
+#define ADDRESS_SPACE_GRANULE 2048
+
+/** @return monotonic time in milliseconds, not affected by system clock changes */
 long get_rtime()
 {
-    struct timeval t;
-    gettimeofday(&t, NULL);
-    return TV_TO_MSEC(t);
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return TS_TO_MSEC(t);
 }
 
 /* The code below uses system files:
@@ -58,49 +78,106 @@ int read_from_proc(const char *filename, const pid_t pid, char *buf, const size_
     char full_fname[PROC_FILENAME_MAX_LEN];
     snprintf(full_fname, PROC_FILENAME_MAX_LEN, "/proc/%d/%s", pid, filename);
     int fd = open(full_fname, O_RDONLY);
-    read(fd, buf, buf_len);
+    if (fd == -1)
+        return -1;
+    ssize_t len = read(fd, buf, buf_len - 1);
     close(fd);
-    return 0; //TODO: add error checking
+    if (len < 0)
+        return -1;
+    buf[len] = '\0';
+    return 0;
 }
 
-/* in microseconds, needs investigation, may be more than ru_utime+ru_stime */
-long get_time_from_proc2(const pid_t pid) {
+/* in milliseconds, from nanoseconds of main thread's run time, -1 if schedstat is not available */
+long get_time_from_schedstat(const pid_t pid) {
     char buf[PROC_READ_BUF_SIZE];
-    read_from_proc("schedstat", pid, buf, PROC_READ_BUF_SIZE);
+    if (read_from_proc("schedstat", pid, buf, PROC_READ_BUF_SIZE))
+        return -1;
     long long time;
-    sscanf(buf, "%lld", &time);
-    return time;
+    if (sscanf(buf, "%lld", &time) != 1)
+        return -1;
+    return time / 1000000;
+}
+
+/* in milliseconds, time main thread was running or waiting for cpu, -1 if schedstat is not available */
+long get_sched_time_from_schedstat(const pid_t pid) {
+    char buf[PROC_READ_BUF_SIZE];
+    if (read_from_proc("schedstat", pid, buf, PROC_READ_BUF_SIZE))
+        return -1;
+    long long run, runnable;
+    if (sscanf(buf, "%lld %lld", &run, &runnable) != 2)
+        return -1;
+    return (run + runnable) / 1000000;
 }
 
 /* in milliseconds, precision is 10 ms, but it's enough */
 long get_time_from_proc(const pid_t pid) {
     char buf[PROC_READ_BUF_SIZE];
-    read_from_proc("stat", pid, buf, PROC_READ_BUF_SIZE);
+    if (read_from_proc("stat", pid, buf, PROC_READ_BUF_SIZE))
+        return 0;
 
     unsigned long stime, utime;
-    sscanf(buf,
+    if (sscanf(buf,
         "%*d %*s %*c %*d %*d " //pid, comm, state, ppid, pgrp
         "%*d %*d %*d %*u "     //session, tty_nr, tpgid, flags
         "%*u %*u %*u %*u "     //minflt, cminflt, majflt, cmajflt
-        "%lu %lu", &stime, &utime);
+        "%lu %lu", &stime, &utime) != 2)
+        return 0;
 
     return (stime + utime)*1000 / sysconf(_SC_CLK_TCK); //return in milliseconds
 }
 
-// in KiloBytes
-long get_mem_from_proc(const pid_t pid) {
-    char buf[512]; //this file is bigger
-    read_from_proc("status", pid, buf, 512);
+/*
+ * in milliseconds, nanosecond precision.
+ * Child's process cpu clock covers all its threads, schedstat and stat are fallbacks.
+ */
+long get_cpu_time(const process_t *proc) {
+    struct timespec t;
+    if (proc->cpu_clock != -1 && clock_gettime(proc->cpu_clock, &t) == 0)
+        return TS_TO_MSEC(t);
 
-    char * pos = strstr(buf, "VmHWM:");
+    long time = get_time_from_schedstat(proc->pid);
+    return time != -1 ? time : get_time_from_proc(proc->pid);
+}
+
+// in KiloBytes, -1 if status is not available, e.g. task is already gone
+long get_status_field(const pid_t pid, const char *field) {
+    char buf[512]; //this file is bigger, but Vm* fields are at the beginning
+    if (read_from_proc("status", pid, buf, 512))
+        return -1;
+
+    char * pos = strstr(buf, field);
     if (!pos)
         return 0;
 
     long mem;
-    sscanf(pos, "%*s %ld", &mem);
+    if (sscanf(pos, "%*s %ld", &mem) != 1)
+        return -1;
     return mem;
 }
 
+long get_mem_from_proc(const pid_t pid) {
+    return get_status_field(pid, "VmHWM:");
+}
+
+/*
+ * Usage of all processes of the run: child's tree and, with namespaces, orphans
+ * reparented to init of its pid namespace (init itself is not counted).
+ */
+void get_tree_usage(const process_t *proc, tree_usage_t *usage) {
+    tree_usage_init(usage);
+    add_tree_usage(proc->pid, true, usage);
+    if (proc->ns.pid_init != -1)
+        add_tree_usage(proc->ns.pid_init, false, usage);
+}
+
+/* Orphans only, child itself is reaped and its tree is in wait4 rusage */
+void get_orphans_usage(const process_t *proc, tree_usage_t *usage) {
+    tree_usage_init(usage);
+    if (proc->ns.pid_init != -1)
+        add_tree_usage(proc->ns.pid_init, false, usage);
+}
+
 void sigalrm_handler(int sig) {
     TRACE("alarm");
 }
@@ -136,14 +213,21 @@ void check_exit_status(stats_t *stats, const int status) {
 
     if ( WIFEXITED(status) && WEXITSTATUS(status) )
         stats->result = _RE;
+    else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGSYS)
+        stats->result = _SV;
+    else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGXCPU) // RLIMIT_CPU backstop
+        stats->result = _TL;
+    else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGXFSZ) // RLIMIT_FSIZE
+        stats->result = _OL;
     else if (WIFSIGNALED(status))
-        stats->result = (WTERMSIG(status) == SIGSYS) ? _SV : _RE;
+        stats->result = _RE;
     else
         stats->result = _OK;
 }
 
+/* Processes of the tree come and go, so sum over them can decrease, peak is kept */
 void check_time(stats_t *stats, const limits_t *limits, const long time) {
-    stats->time = time;
+    stats->time = (time > stats->time) ? (time) : (stats->time);
     if (stats->result == _OK && time > limits->time)
         stats->result = _TL;
 }
@@ -160,15 +244,257 @@ void check_memory(stats_t *stats, const limits_t *limits, const long mem) {
         stats->result = _ML;
 }
 
+/*
+ * Program blocked on read() or sleeping doesn't get cpu time, it's IL once that lasts
+ * limits->idle. Time is seen by sampling, so the verdict may come one period later.
+ */
+void check_idle(stats_t *stats, const limits_t *limits) {
+    long long now = stats->start_time + stats->real_time;
+    if (stats->time > stats->progress_cpu) {
+        stats->progress_cpu = stats->time;
+        stats->progress_time = now;
+    } else if (stats->result == _OK && limits->idle > 0 && now - stats->progress_time > limits->idle) {
+        stats->result = _IL;
+    }
+}
 
-void hypervisor(process_t *proc) {
-    proc->stats.start_time = get_rtime();
+void check_tasks(stats_t *stats, const long tasks) {
+    stats->tasks = (tasks > stats->tasks) ? (tasks) : (stats->tasks);
+}
+
+/* Kernel enforces memory limit in cgroup by itself, we only need to notice it */
+void check_oom(stats_t *stats, cgroup_t *cg) {
+    if (stats->result == _OK && cgroup_oom_killed(cg))
+        stats->result = _ML;
+}
+
+
+/*
+ * Kills all processes of the run at once, not only the child:
+ *  - cgroup.kill if cgroup is used;
+ *  - init of pid namespace, kernel kills the whole namespace with it;
+ *  - otherwise the tree is stopped and killed, see kill_tree().
+ * Time of the first call is the start of kill latency, it ends in release_process().
+ */
+void kill_run(process_t *proc) {
+    if (proc->stats.kill_time == -1)
+        proc->stats.kill_time = get_rtime();
+
+    if (proc->cgroup.path && cgroup_kill(&proc->cgroup) == 0)
+        return;
+
+    if (proc->ns.pid_init != -1) {
+        kill(proc->ns.pid_init, SIGKILL); //not reaped until release, so pid can't be reused
+        kill(proc->pid, SIGKILL);
+    } else {
+        kill_tree(proc->pid);
+    }
+}
+
+/*
+ * Allocation beyond RLIMIT_AS just fails with ENOMEM, program usually dies after it.
+ * RE is ML only when the limit was surely hit: program died of SIGSEGV or SIGABRT (null pointer,
+ * bad_alloc) with address space seen within one mapping granule of the limit.
+ * Otherwise it stays RE, peak of address space is reported anyway.
+ */
+void check_address_space(stats_t *stats, const rlimits_t *rlimits) {
+    if (stats->result != _RE || rlimits->as <= 0 || !WIFSIGNALED(stats->status))
+        return;
+    int sig = WTERMSIG(stats->status);
+    if ((sig == SIGSEGV || sig == SIGABRT) && stats->vm_peak >= rlimits->as - ADDRESS_SPACE_GRANULE)
+        stats->result = _ML;
+}
+
+/*
+ * Tmpfs is one block above the quota, so usage above the quota means some write went past it and
+ * likely failed. Usage is only sampled, files written and deleted between samples aren't seen.
+ */
+void check_disk(stats_t *stats, const limits_t *limits, const int scratch_fd) {
+    if (scratch_fd == -1)
+        return;
+    long long used = get_scratch_usage(scratch_fd);
+    if (used > stats->disk)
+        stats->disk = used;
+    if (limits->disk > 0 && stats->disk > limits->disk * 1024LL && (stats->result == _OK || stats->result == _RE))
+        stats->result = _DL;
+}
+
+/* Counters of the run only grow, instructions are checked when sampling like memory is */
+void check_perf(stats_t *stats, const limits_t *limits, const perf_t *perf) {
+    perf_read(perf, stats->perf);
+    long long instructions = stats->perf[PERF_INSTRUCTIONS];
+    if (stats->result == _OK && limits->instructions > 0 && instructions > limits->instructions * 1000000LL)
+        stats->result = _TL;
+}
+
+/* Output is drained by now, it's WA if it doesn't match --expect and nothing else is wrong */
+void check_answer(stats_t *stats, checker_t *checker) {
+    checker_finish(checker);
+    stats->mismatch = checker->mismatch;
+    if (stats->result == _OK && stats->mismatch != -1)
+        stats->result = _WA;
+}
+
+/* Collects final stats of terminated child from wait4 results */
+void finish(process_t *proc, const int status, const struct rusage *usage) {
+    DEBUG("process terminated");
+    check_rtime(&proc->stats, &proc->limits);
+    if (proc->cgroup.path) {
+        check_oom(&proc->stats, &proc->cgroup);
+        check_time(&proc->stats, &proc->limits, cgroup_get_time(&proc->cgroup));
+        check_memory(&proc->stats, &proc->limits, cgroup_get_mem(&proc->cgroup));
+        check_tasks(&proc->stats, cgroup_get_tasks(&proc->cgroup));
+    } else {
+        tree_usage_t orphans;
+        get_orphans_usage(proc, &orphans);
+        const long time = TV_TO_MSEC(usage->ru_utime) + TV_TO_MSEC(usage->ru_stime) + orphans.time;
+        check_time(&proc->stats, &proc->limits, time);
+        // peak of the biggest process, the limit is checked against the larger of it and sampled sum of the tree
+        check_memory(&proc->stats, &proc->limits, usage->ru_maxrss);
+    }
+    if (proc->use_perf)
+        check_perf(&proc->stats, &proc->limits, &proc->perf);
+    check_exit_status(&proc->stats, status);
+    check_address_space(&proc->stats, &proc->jail.rlimits);
+    check_disk(&proc->stats, &proc->limits, proc->scratch_fd);
+    if (proc->checker.expected)
+        check_answer(&proc->stats, &proc->checker);
+    DEBUG("maxrss: %ld, rtime: %ld, time: %ld, mem: %ld, result = %d",
+            usage->ru_maxrss, proc->stats.real_time, proc->stats.time, proc->stats.mem, proc->stats.result);
+}
+
+/* Rest of the real time main process was sleeping, which is blocking on the peer for --interactor */
+void check_wait_time(stats_t *stats, const long sched_time) {
+    if (sched_time == -1)
+        return;
+    stats->wait_time = stats->real_time > sched_time ? stats->real_time - sched_time : 0;
+}
+
+/* Reaps the child, which is known to be terminated, and collects final stats */
+void reap(process_t *proc) {
+    int status;
+    struct rusage usage;
+    pid_t ret;
+
+    // schedstat of zombie is still there, it's gone after wait4
+    long sched_time = get_sched_time_from_schedstat(proc->pid);
+
+    do {
+        ret = wait4(proc->pid, &status, 0, &usage);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret != proc->pid) {
+        SYSERROR("wait4 failed");
+        proc->stats.result = _SC;
+        return;
+    }
 
+    finish(proc, status, &usage);
+    check_wait_time(&proc->stats, sched_time);
+}
+
+/*
+ * Periodic check of limits that can't be waited for.
+ * Without cgroup usage is summed over the process tree: time of main process is precise
+ * from its cpu clock, memory is its VmHWM or resident memory of all processes, whichever is bigger.
+ */
+void sample(process_t *proc) {
+    check_rtime(&proc->stats, &proc->limits);
+
+    tree_usage_t tree;
+    bool has_tree = !proc->cgroup.path || proc->cgroup.pids_fd == -1;
+    if (has_tree)
+        get_tree_usage(proc, &tree);
+
+    if (proc->cgroup.path) {
+        check_oom(&proc->stats, &proc->cgroup);
+        check_time(&proc->stats, &proc->limits, cgroup_get_time(&proc->cgroup));
+        check_memory(&proc->stats, &proc->limits, cgroup_get_mem(&proc->cgroup));
+    } else {
+        long time = get_cpu_time(proc), mem = get_mem_from_proc(proc->pid);
+        check_time(&proc->stats, &proc->limits, tree.time > time ? tree.time : time);
+        check_memory(&proc->stats, &proc->limits, tree.mem > mem ? tree.mem : mem);
+    }
+    check_tasks(&proc->stats, has_tree ? tree.tasks : cgroup_get_tasks(&proc->cgroup));
+    check_idle(&proc->stats, &proc->limits);
+    check_disk(&proc->stats, &proc->limits, proc->scratch_fd);
+    if (proc->use_perf)
+        check_perf(&proc->stats, &proc->limits, &proc->perf);
+
+    if (proc->jail.rlimits.as > 0) {
+        long vm_peak = get_status_field(proc->pid, "VmPeak:");
+        if (vm_peak > proc->stats.vm_peak)
+            proc->stats.vm_peak = vm_peak;
+    }
+
+    TRACE("Current stats:\n"
+              "real time = %ld ms\n"
+              "time = %ld ms\n"
+              "mem = %ld kb\n"
+              "tasks = %d\n"
+              "result = %d",
+              proc->stats.real_time,
+              proc->stats.time,
+              proc->stats.mem,
+              proc->stats.tasks,
+              proc->stats.result);
+
+    if (proc->stats.result != _OK) //one of the limits exceeded
+        kill_run(proc);
+}
+
+/*
+ * Kernel timer on child's cpu clock, sends signo to us when the cpu time limit is reached.
+ * Much more precise than sampling, kernel checks cpu timers on every tick.
+ */
+bool create_cpu_timer(process_t *proc, int signo, void *data, timer_t *timer) {
+    if (proc->cpu_clock == -1)
+        return false;
+
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = signo;
+    sev.sigev_value.sival_ptr = data;
+    if (timer_create(proc->cpu_clock, &sev, timer) == -1) {
+        SYSWARN("can't create cpu timer");
+        return false;
+    }
+
+    // +1 ms because check_time() treats reaching the limit exactly as OK
+    struct itimerspec spec;
+    spec.it_value.tv_sec = (proc->limits.time + 1) / 1000;
+    spec.it_value.tv_nsec = ((proc->limits.time + 1) % 1000) * 1000000;
+    spec.it_interval.tv_sec = 0;
+    spec.it_interval.tv_nsec = 0;
+    if (timer_settime(*timer, 0, &spec, NULL) == -1) {
+        SYSWARN("can't arm cpu timer");
+        timer_delete(*timer);
+        return false;
+    }
+    return true;
+}
+
+/* Drains output of all captured streams, the run is killed on OL */
+void drain_output(process_t *proc) {
+    if (proc->out.read_fd != -1)
+        capture_drain(proc, &proc->out);
+    if (proc->err.read_fd != -1)
+        capture_drain(proc, &proc->err);
+    if (proc->stats.result != _OK)
+        kill_run(proc);
+}
+
+/*
+ * Old engine: SIGALRM interrupts wait4 every HYPERVISOR_DELAY. Used when pidfd is not supported.
+ * Captured output is drained only then, so the program may wait on a full pipe till the next period.
+ */
+void hypervise_polling(process_t *proc) {
     set_sigalrm_handler(sigalrm_handler);
 
-    proc->stats.mem = 0;
-    proc->stats.time = 0;
-    proc->stats.real_time = 0;
+    // cpu timer interrupts wait4 the same way as sampling alarm does
+    timer_t cpu_timer;
+    bool has_cpu_timer = create_cpu_timer(proc, SIGALRM, NULL, &cpu_timer);
 
     while(1) {
         set_timeout(HYPERVISOR_DELAY);
@@ -178,34 +504,215 @@ void hypervisor(process_t *proc) {
         pid_t ret = wait4(proc->pid, &status, 0, &usage);
 
         if (ret == proc->pid) { /* if child terminated */
-            DEBUG("process terminated");
             reset_timeout();
+            drain_output(proc);
+            finish(proc, status, &usage);
+            break;
+        }
+
+        drain_output(proc);
+        sample(proc);
+    }
+
+    if (has_cpu_timer)
+        timer_delete(cpu_timer);
+}
+
+int open_pidfd(pid_t pid) {
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+int create_timer(long first_usecs, long interval_usecs, bool absolute) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd == -1)
+        return -1;
+
+    struct itimerspec spec;
+    spec.it_value.tv_sec = first_usecs / 1000000;
+    spec.it_value.tv_nsec = (first_usecs % 1000000) * 1000;
+    spec.it_interval.tv_sec = interval_usecs / 1000000;
+    spec.it_interval.tv_nsec = (interval_usecs % 1000000) * 1000;
+
+    if (timerfd_settime(fd, absolute ? TFD_TIMER_ABSTIME : 0, &spec, NULL) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool epoll_watch(int epfd, int fd) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+void consume_timer(int fd) {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+        SYSWARN("can't read timerfd");
+}
+
+/*
+ * Event-driven engine. Waits in one epoll on:
+ *  - pidfd, readable as soon as the child exits;
+ *  - deadline timer, fires exactly at the real time limit;
+ *  - cpu timer on child's cpu clock, its signal comes through signalfd at the cpu time limit;
+ *  - sampling timer, fires every HYPERVISOR_DELAY to check cpu time and memory;
+ *  - inotify on cgroup's memory.events (if cgroup is used), to classify oom kill as ML;
+ *  - pipes of captured stdout and stderr.
+ *
+ * @return false if pidfd/epoll/timerfd is not available and nothing was done
+ */
+bool hypervise_events(process_t *proc) {
+    int pidfd = -1, deadline_fd = -1, sample_fd = -1, cpu_timer_fd = -1;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    bool ok = false;
+
+    timer_t cpu_timer;
+    bool has_cpu_timer = false;
+    sigset_t cpu_timer_mask, old_mask;
+    sigemptyset(&cpu_timer_mask);
+    sigaddset(&cpu_timer_mask, SIGRTMIN);
+
+    if (epfd == -1)
+        goto out;
+
+    pidfd = open_pidfd(proc->pid);
+    if (pidfd == -1) {
+        DEBUG("pidfd_open failed: %s", strerror(errno));
+        goto out;
+    }
+
+    // +1 ms because check_rtime() treats reaching the limit exactly as OK
+    deadline_fd = create_timer((proc->stats.start_time + proc->limits.real_time + 1) * 1000, 0, true);
+    sample_fd = create_timer(HYPERVISOR_DELAY, HYPERVISOR_DELAY, false);
+    if (deadline_fd == -1 || sample_fd == -1) {
+        SYSWARN("can't create timerfd");
+        goto out;
+    }
+
+    if (!epoll_watch(epfd, pidfd) || !epoll_watch(epfd, deadline_fd) || !epoll_watch(epfd, sample_fd)) {
+        SYSWARN("can't add fd to epoll");
+        goto out;
+    }
 
-            check_rtime(&proc->stats, &proc->limits);
-            const long time = TV_TO_MSEC(usage.ru_utime) + TV_TO_MSEC(usage.ru_stime);
-            check_time(&proc->stats, &proc->limits, time);
-            check_memory(&proc->stats, &proc->limits, usage.ru_maxrss);
-            check_exit_status(&proc->stats, status);
-            DEBUG("maxrss: %d, rtime: %d, time: %d, result = %d",
-                    usage.ru_maxrss, proc->stats.real_time, time, proc->stats.result);
+    if (proc->cgroup.notify_fd != -1 && !epoll_watch(epfd, proc->cgroup.notify_fd))
+        SYSWARN("can't add memory.events to epoll"); //not a critical, oom is still checked when sampling
+
+    if (proc->syscall_profile && !epoll_watch(epfd, proc->syscall_profile->notify_fd)) {
+        SYSERROR("can't add seccomp listener to epoll");
+        kill_run(proc); //would hang on the first unlisted syscall
+    }
+
+    if ((proc->out.read_fd != -1 && !epoll_watch(epfd, proc->out.read_fd))
+            || (proc->err.read_fd != -1 && !epoll_watch(epfd, proc->err.read_fd))) {
+        SYSERROR("can't add output pipe to epoll");
+        kill_run(proc); //would hang on full pipe
+    }
+
+    // Not critical too, without cpu timer time limit is checked only when sampling
+    sigprocmask(SIG_BLOCK, &cpu_timer_mask, &old_mask);
+    cpu_timer_fd = signalfd(-1, &cpu_timer_mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (cpu_timer_fd != -1 && epoll_watch(epfd, cpu_timer_fd))
+        has_cpu_timer = create_cpu_timer(proc, SIGRTMIN, NULL, &cpu_timer);
+
+    ok = true;
+    while (1) {
+        struct epoll_event events[8];
+        int n = epoll_wait(epfd, events, 8, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            SYSERROR("epoll_wait failed");
+            kill_run(proc);
+            reap(proc);
+            proc->stats.result = _SC;
             break;
         }
 
-        check_rtime(&proc->stats, &proc->limits);
-        check_time(&proc->stats, &proc->limits, get_time_from_proc(proc->pid));
-        check_memory(&proc->stats, &proc->limits, get_mem_from_proc(proc->pid));
+        bool exited = false;
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == pidfd) {
+                exited = true;
+            } else if (fd == deadline_fd) {
+                consume_timer(fd);
+                check_rtime(&proc->stats, &proc->limits);
+                if (proc->stats.result != _OK)
+                    kill_run(proc);
+            } else if (fd == sample_fd) {
+                consume_timer(fd);
+                sample(proc);
+            } else if (fd == cpu_timer_fd) {
+                struct signalfd_siginfo info;
+                while (read(fd, &info, sizeof(info)) > 0)
+                    ;
+                sample(proc);
+            } else if (fd == proc->cgroup.notify_fd) {
+                cgroup_consume_events(&proc->cgroup);
+                check_oom(&proc->stats, &proc->cgroup);
+                if (proc->stats.result != _OK)
+                    kill_run(proc);
+            } else if (proc->syscall_profile && fd == proc->syscall_profile->notify_fd) {
+                if (events[i].events & EPOLLHUP) //all processes under the filter are gone
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                else
+                    syscall_profile_handle(proc->syscall_profile);
+            } else if (fd == proc->out.read_fd || fd == proc->err.read_fd) {
+                capture_t *c = (fd == proc->out.read_fd) ? &proc->out : &proc->err;
+                if (!capture_drain(proc, c))
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                if (proc->stats.result != _OK)
+                    kill_run(proc);
+            }
+        }
 
-        TRACE("Current stats:\n"
-                  "real time = %d ms\n"
-                  "time = %d ms\n"
-                  "mem = %d kb\n"
-                  "result = %d",
-                  proc->stats.real_time,
-                  proc->stats.time,
-                  proc->stats.mem,
-                  proc->stats.result);
+        if (exited) {
+            drain_output(proc);
+            reap(proc);
+            break;
+        }
+    }
 
-        if (proc->stats.result != _OK) //one of the limits exceeded
-            kill(proc->pid, SIGKILL);
+out:
+    if (has_cpu_timer) timer_delete(cpu_timer);
+    if (cpu_timer_fd != -1) {
+        close(cpu_timer_fd);
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
     }
+    if (sample_fd != -1) close(sample_fd);
+    if (deadline_fd != -1) close(deadline_fd);
+    if (pidfd != -1) close(pidfd);
+    if (epfd != -1) close(epfd);
+    return ok;
+}
+
+/* Called right after spawn, before any checks */
+void init_stats(process_t *proc) {
+    proc->stats.start_time = get_rtime();
+
+    proc->stats.mem = 0;
+    proc->stats.time = 0;
+    proc->stats.real_time = 0;
+    proc->stats.vm_peak = 0;
+    proc->stats.tasks = 1;
+    proc->stats.progress_time = proc->stats.start_time;
+    proc->stats.progress_cpu = 0;
+    proc->stats.wait_time = -1;
+    proc->stats.disk = -1;
+    for (int i = 0; i < PERF_COUNTERS; ++i)
+        proc->stats.perf[i] = -1;
+
+    if (clock_getcpuclockid(proc->pid, &proc->cpu_clock)) {
+        WARN("can't get cpu clock of the child, time will be sampled from /proc");
+        proc->cpu_clock = -1;
+    }
+}
+
+void hypervisor(process_t *proc) {
+    init_stats(proc);
+
+    if (!hypervise_events(proc))
+        hypervise_polling(proc);
 }
@@ -16,6 +16,25 @@
 #ifndef HYPERVISOR_H_
 #define HYPERVISOR_H_
 
+#include "process.h"
+
+#include <time.h>
+
+/* in usecs */
+#define HYPERVISOR_DELAY 25*1000
+
 void hypervisor(process_t *proc);
 
+/* Parts of hypervisor, also used by supervisor */
+long get_rtime();
+int open_pidfd(pid_t pid);
+bool create_cpu_timer(process_t *proc, int signo, void *data, timer_t *timer);
+void init_stats(process_t *proc);
+void check_rtime(stats_t *stats, const limits_t *limits);
+void check_oom(stats_t *stats, cgroup_t *cg);
+void sample(process_t *proc);
+void kill_run(process_t *proc);
+void drain_output(process_t *proc);
+void reap(process_t *proc);
+
 #endif /* HYPERVISOR_H_ */
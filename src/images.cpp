@@ -0,0 +1,104 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "images.h"
+#include "caller.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/*
+ * Images file format, one image per line:
+ *   name root_dir [pool_size]
+ *
+ * e.g. "python3 /srv/images/python3 8".
+ * Runs select image by name with --image, --serve keeps pool_size children (default: 0)
+ * with overlay root of every image jailed in advance, so a clean root is claimed at once.
+ * Empty lines and lines starting with '#' are skipped.
+ */
+
+static image_t *images = NULL;
+static int count = 0;
+
+/** @return -1 on error */
+int read_images(const char *path) {
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        SYSERROR("Can't open images file ""%s""", path);
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_no = 0, ret = 0;
+    while (getline(&line, &line_size, f) != -1) {
+        ++line_no;
+        const char *delim = " \t\r\n";
+        char *saveptr;
+        char *name = strtok_r(line, delim, &saveptr);
+        if (!name || name[0] == '#')
+            continue;
+        char *root = strtok_r(NULL, delim, &saveptr);
+        char *pool = strtok_r(NULL, delim, &saveptr);
+
+        struct stat st;
+        if (!root || stat(root, &st) == -1 || !S_ISDIR(st.st_mode) || image_find(name)) {
+            ERROR("Bad image at line %d of %s", line_no, path);
+            ret = -1;
+            break;
+        }
+
+        images = (image_t *) realloc(images, (count + 1) * sizeof(image_t));
+        images[count].name = strdup(name);
+        images[count].root = strdup(root);
+        images[count].pool = pool ? atoi(pool) : 0;
+        DEBUG("image %s at %s, pool of %d", name, root, images[count].pool);
+        ++count;
+    }
+
+    free(line);
+    fclose(f);
+    return ret;
+}
+
+/* We may be setuid root, images file and roots it names are seen with permissions of the real caller */
+int images_load(const char *path) {
+    uid_t euid;
+    if (!drop_euid(&euid))
+        return -1;
+    int ret = read_images(path);
+    restore_euid(euid);
+    return ret;
+}
+
+/** @return NULL if there is no such image */
+const image_t *image_find(const char *name) {
+    for (int i = 0; i < count; ++i)
+        if (!strcmp(images[i].name, name))
+            return &images[i];
+    return NULL;
+}
+
+int images_count() {
+    return count;
+}
+
+const image_t *image_get(int i) {
+    return &images[i];
+}
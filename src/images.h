@@ -0,0 +1,33 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef IMAGES_H_
+#define IMAGES_H_
+
+/* Read-only root filesystem of a language, runs get writable overlay of it */
+struct image_t {
+    char *name;
+    char *root;
+    int pool; /**< children kept jailed in it by --serve */
+};
+
+int images_load(const char *path);
+const image_t *image_find(const char *name);
+int images_count();
+const image_t *image_get(int i);
+
+#endif /* IMAGES_H_ */
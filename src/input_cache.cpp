@@ -0,0 +1,173 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "input_cache.h"
+#include "spawn.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#define INPUT_CACHE_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+/*
+ * Inputs of --redirect-stdin loaded once into sealed memfds, shared by all runs on the same test.
+ * Every run gets its own open file description of the memfd (reopened through /proc/self/fd),
+ * so runs don't share file offset. It is seekable and mmappable like a regular file,
+ * and its pages are the same for all runs.
+ *
+ * Entries are keyed by path as the child sees it (chroot, chdir, file) and are valid while
+ * mtime and size of the file are the same. Least recently used ones are evicted to fit
+ * into max_kbytes, bigger files are not cached.
+ */
+
+struct input_t {
+    char *key;
+    struct timespec mtime;
+    off_t size;
+    int memfd;
+    unsigned long long used; /**< tick of the last use, for LRU */
+};
+
+static input_t *inputs = NULL;
+static int input_count = 0;
+static long long cache_size = 0, cache_max = 0;
+static unsigned long long tick = 0;
+
+void input_cache_init(long max_kbytes) {
+    cache_max = max_kbytes * 1024LL;
+}
+
+bool input_cache_enabled() {
+    return cache_max > 0;
+}
+
+void remove_input(int i) {
+    close(inputs[i].memfd);
+    free(inputs[i].key);
+    cache_size -= inputs[i].size;
+    inputs[i] = inputs[--input_count];
+}
+
+void evict_for(off_t size) {
+    while (input_count && cache_size + size > cache_max) {
+        int lru = 0;
+        for (int i = 1; i < input_count; ++i)
+            if (inputs[i].used < inputs[lru].used)
+                lru = i;
+        TRACE("input %s is evicted from cache", inputs[lru].key);
+        remove_input(lru);
+    }
+}
+
+/* @return sealed memfd with contents of fd, -1 on error */
+int load_input(int fd, off_t size) {
+    int memfd = memfd_create("srun2-stdin", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd == -1) {
+        SYSWARN("can't create memfd for input");
+        return -1;
+    }
+
+    off_t offset = 0;
+    while (offset < size) {
+        ssize_t ret = sendfile(memfd, fd, &offset, size - offset);
+        if (ret <= 0) {
+            SYSWARN("can't load input to memfd");
+            close(memfd);
+            return -1;
+        }
+    }
+
+    if (fcntl(memfd, F_ADD_SEALS, INPUT_CACHE_SEALS) == -1) {
+        SYSWARN("can't seal memfd of input");
+        close(memfd);
+        return -1;
+    }
+    return memfd;
+}
+
+/* New open file description of memfd, read-only, with its own offset */
+int reopen_input(int memfd) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", memfd);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        SYSWARN("can't reopen memfd of input");
+    return fd;
+}
+
+/**
+ * Stdin for a run from cache, file is loaded if it isn't there or has changed.
+ * @return fd to be stdin of the child, -1 if the child should open file by itself
+ */
+int input_cache_open(const jail_t *jail, const char *filename) {
+    int fd = open_in_jail(jail, filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size > cache_max) {
+        if (fd != -1)
+            close(fd);
+        return -1; //errors are reported by the child as before
+    }
+
+    char *key;
+    if (asprintf(&key, "%s:%s:%s", jail->chroot ? jail->chroot : "", jail->chdir ? jail->chdir : "", filename) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    int found = -1;
+    for (int i = 0; i < input_count && found == -1; ++i)
+        if (!strcmp(inputs[i].key, key))
+            found = i;
+
+    if (found != -1 && (inputs[found].size != st.st_size || inputs[found].mtime.tv_sec != st.st_mtim.tv_sec
+            || inputs[found].mtime.tv_nsec != st.st_mtim.tv_nsec)) {
+        TRACE("input %s has changed", key);
+        remove_input(found);
+        found = -1;
+    }
+
+    if (found == -1) {
+        evict_for(st.st_size);
+        int memfd = load_input(fd, st.st_size);
+        if (memfd == -1) {
+            close(fd);
+            free(key);
+            return -1;
+        }
+
+        inputs = (input_t *) realloc(inputs, (input_count + 1) * sizeof(input_t));
+        found = input_count++;
+        inputs[found].key = key;
+        inputs[found].mtime = st.st_mtim;
+        inputs[found].size = st.st_size;
+        inputs[found].memfd = memfd;
+        cache_size += st.st_size;
+        DEBUG("input %s is cached, %lld bytes in cache", key, cache_size);
+    } else {
+        free(key);
+    }
+    close(fd);
+
+    inputs[found].used = ++tick;
+    return reopen_input(inputs[found].memfd);
+}
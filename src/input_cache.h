@@ -0,0 +1,26 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef INPUT_CACHE_H_
+#define INPUT_CACHE_H_
+
+#include "process.h"
+
+void input_cache_init(long max_kbytes);
+bool input_cache_enabled();
+int input_cache_open(const jail_t *jail, const char *filename);
+
+#endif /* INPUT_CACHE_H_ */
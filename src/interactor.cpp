@@ -0,0 +1,150 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "interactor.h"
+#include "spawn.h"
+#include "supervisor.h"
+#include "hypervisor.h"
+#include "log.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/*
+ * Interactive run: solution and interactor are two runs with their own jails and limits,
+ * stdout of one is stdin of the other through plain pipes, so every message costs
+ * only a pipe wakeup, srun2 is not in between. Both are supervised by one supervisor.
+ *
+ * Interactor exits with 0 if it accepts the dialogue, with any other code it is WA.
+ */
+
+int create_pipe(int *fds, int pipe_kbytes) {
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        SYSERROR("can't create pipe");
+        return -1;
+    }
+    // not critical, pipe of default size works too
+    if (pipe_kbytes > 0 && fcntl(fds[1], F_SETPIPE_SZ, pipe_kbytes * 1024) == -1)
+        SYSWARN("can't set pipe size to %d Kbytes", pipe_kbytes);
+    return 0;
+}
+
+/** Cross-connects stdin and stdout of solution and interactor. @return -1 on error */
+int interactor_connect(process_t *solution, process_t *interactor, int pipe_kbytes) {
+    int to_solution[2], to_interactor[2];
+    if (create_pipe(to_solution, pipe_kbytes) == -1)
+        return -1;
+    if (create_pipe(to_interactor, pipe_kbytes) == -1) {
+        close(to_solution[0]);
+        close(to_solution[1]);
+        return -1;
+    }
+
+    solution->stdin_fd = to_solution[0];
+    solution->stdout_fd = to_interactor[1];
+    interactor->stdin_fd = to_interactor[0];
+    interactor->stdout_fd = to_solution[1];
+    return 0;
+}
+
+bool is_limit_result(result_t result) {
+    return result != _OK && result != _RE && result != _WA;
+}
+
+/*
+ * Limits of the solution come first, then the interactor's opinion, then exit of the solution:
+ * solution which gets SIGPIPE because interactor has rejected it is WA, not RE.
+ * Interactor which itself fails is SC, it's not the fault of the solution.
+ */
+void combine_results(process_t *solution, const process_t *interactor) {
+    const stats_t *stats = &interactor->stats;
+    if (is_limit_result(solution->stats.result))
+        return;
+    if (stats->result == _RE && WIFEXITED(stats->status))
+        solution->stats.result = _WA;
+    else if (stats->result != _OK)
+        solution->stats.result = _SC;
+}
+
+struct interaction_t {
+    process_t *solution;
+    bool solution_running;
+};
+
+/* Once the interactor has given up, the solution won't get anything more */
+void interactor_finished(process_t *interactor, void *data) {
+    interaction_t *interaction = (interaction_t *) data;
+    DEBUG("interactor finished, result = %d", interactor->stats.result);
+    if (interactor->stats.result != _OK && interaction->solution_running)
+        kill_run(interaction->solution);
+}
+
+void solution_finished(process_t *, void *data) {
+    ((interaction_t *) data)->solution_running = false;
+}
+
+/* Pipes of interactor_connect which are not passed to a child, when runs can't be spawned */
+void close_pipes(process_t *proc) {
+    if (proc->stdin_fd != -1)
+        close(proc->stdin_fd);
+    if (proc->stdout_fd != -1)
+        close(proc->stdout_fd);
+    proc->stdin_fd = proc->stdout_fd = -1;
+}
+
+/** Runs connected solution and interactor until both exit. @return -1 on error */
+int run_interactive(process_t *solution, process_t *interactor) {
+    supervisor_t *sv = supervisor_create();
+    if (!sv || spawn_process(interactor) == -1) {
+        close_pipes(interactor);
+        close_pipes(solution);
+        return -1;
+    }
+    if (spawn_process(solution) == -1) {
+        close_pipes(solution);
+        kill_run(interactor);
+        reap(interactor);
+        release_process(interactor);
+        return -1;
+    }
+
+    interaction_t interaction = { solution, true };
+    if (supervisor_add(sv, interactor, interactor_finished, &interaction) == -1) {
+        kill_run(solution);
+        reap(solution);
+        release_process(solution);
+        release_process(interactor);
+        return -1;
+    }
+    if (supervisor_add(sv, solution, solution_finished, &interaction) == -1) {
+        kill_run(interactor);
+        while (supervisor_count(sv))
+            supervisor_wait(sv);
+        release_process(solution);
+        release_process(interactor);
+        return -1;
+    }
+
+    while (supervisor_count(sv))
+        supervisor_wait(sv);
+
+    release_process(solution);
+    release_process(interactor);
+    combine_results(solution, interactor);
+    return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef INTERACTOR_H_
+#define INTERACTOR_H_
+
+#include "process.h"
+
+int interactor_connect(process_t *solution, process_t *interactor, int pipe_kbytes);
+int run_interactive(process_t *solution, process_t *interactor);
+
+#endif /* INTERACTOR_H_ */
@@ -18,6 +18,17 @@
 #include "parser.h"
 #include "spawn.h"
 #include "hypervisor.h"
+#include "namespaces.h"
+#include "input_cache.h"
+#include "interactor.h"
+#include "placement.h"
+#include "calibration.h"
+#include "mount_jail.h"
+#include "images.h"
+#include "setup_seccomp.h"
+#include "syscall_profile.h"
+#include "server.h"
+#include "batch.h"
 #include "log.h"
 
 #include <stdio.h>
@@ -25,60 +36,266 @@
 
 static process_t proc;
 bool output_for_human = false;
+static char *serve_socket = NULL;
+static int serve_workers = 0;
+static int pool_size = 0;
+static int stdin_cache = 0;
+static char *images_file = NULL;
+static bool placement = false;
+static bool placement_idle_smt = false;
+static char *calibration_file = NULL;
+static bool calibrate_now = false;
+static char *batch_manifest = NULL;
+static char *interactor_cmd = NULL;
+static int interactor_time = 0;
+static int interactor_mem = 0;
+static int interactor_pipe = 0;
+static process_t interactor;
+static bool batch_stop = false;
+static bool syscall_profile_mode = false;
+static syscall_profile_t syscall_profile;
+static process_t base_proc; /**< options of the command line, every test or request starts from them */
 
 static parser_option_t options[] = {
     { "--chdir",    "-d", PARSER_ARG_STR,  &proc.jail.chdir,       "Change directory to dir (done after chroot)" },
     { "--chroot",   "-c", PARSER_ARG_STR,  &proc.jail.chroot,      "Do a chroot"},
-    { "--mem",      "-m", PARSER_ARG_INT,  &proc.limits.mem,       "Limit memory usage (in Kbytes)"},
-    { "--time",     "-t", PARSER_ARG_INT,  &proc.limits.time,      "Limit user+system execution time (in ms)"},
-    { "--real-time","-r", PARSER_ARG_INT,  &proc.limits.real_time, "Limit real execution time (in ms)"},
+    { "--jail-ns",      "", PARSER_ARG_BOOL, &proc.jail.mount_ns, "Enter --chroot read-only with pivot_root in own mount namespace instead of chroot"},
+    { "--jail-scratch", "", PARSER_ARG_LONG, &proc.jail.scratch,  "Mount writable tmpfs of that size (in Kbytes) at " JAIL_SCRATCH_DIR " of --jail-ns"},
+    { "--jail-overlay", "", PARSER_ARG_BOOL, &proc.jail.overlay,  "Make --jail-ns root writable overlay of --chroot, writes go to tmpfs of --jail-scratch size"},
+    { "--images",       "", PARSER_ARG_STR,  &images_file,        "Load images (\"name root_dir [pool_size]\" lines) from file"},
+    { "--image",        "", PARSER_ARG_STR,  &proc.image,         "Run in overlay of image from --images, like --chroot root_dir --jail-overlay"},
+    { "--disk-quota",   "", PARSER_ARG_LONG, &proc.limits.disk,   "Limit size of files in writable area of --jail-ns (in Kbytes), result is DL"},
+    { "--mem",      "-m", PARSER_ARG_LONG, &proc.limits.mem,       "Limit memory usage (in Kbytes)"},
+    { "--time",     "-t", PARSER_ARG_LONG, &proc.limits.time,      "Limit user+system execution time (in ms)"},
+    { "--real-time","-r", PARSER_ARG_LONG, &proc.limits.real_time, "Limit real execution time (in ms)"},
+    { "--idle",     "",   PARSER_ARG_LONG, &proc.limits.idle,      "Limit time without cpu progress (in ms), result is IL"},
+    { "--perf",         "", PARSER_ARG_BOOL, &proc.use_perf,           "Count instructions, cycles, task clock, context switches and page faults with perf_event"},
+    { "--instructions", "", PARSER_ARG_LONG, &proc.limits.instructions, "Limit instructions retired in user mode (in millions), result is TL, implies --perf"},
     { "--seccomp",  "-s", PARSER_ARG_BOOL, &proc.use_seccomp,      "Use seccomp to ensure security"},
-    { "--usens",    "-n", PARSER_ARG_BOOL, &proc.use_namespaces,   "Use namespaces to ensure security (adds 30ms overhead)"},
+    { "--seccomp-profile", "", PARSER_ARG_STR, &proc.seccomp_profile, "Seccomp profile: name in " SECCOMP_PROFILE_DIR ", path or \"default\""},
+    { "--syscall-profile", "", PARSER_ARG_BOOL, &syscall_profile_mode, "Don't enforce seccomp profile, report syscalls outside of it instead"},
+    { "--max-as",       "", PARSER_ARG_LIMIT, &proc.jail.rlimits.as,       "Limit address space (in Kbytes), allocations beyond it fail"},
+    { "--stack",        "", PARSER_ARG_LIMIT, &proc.jail.rlimits.stack,    "Limit stack size (in Kbytes), \"unlimited\" for deep recursion"},
+    { "--max-files",    "", PARSER_ARG_LIMIT, &proc.jail.rlimits.files,    "Limit number of open files"},
+    { "--max-filesize", "", PARSER_ARG_LIMIT, &proc.jail.rlimits.filesize, "Limit size of written files (in Kbytes), result is OL"},
+    { "--max-procs",    "", PARSER_ARG_LIMIT, &proc.jail.rlimits.procs,    "Limit number of processes of the real user"},
+    { "--max-core",     "", PARSER_ARG_LIMIT, &proc.jail.rlimits.core,     "Limit size of core dumps (in Kbytes, default: 0)"},
+    { "--usens",    "-n", PARSER_ARG_BOOL, &proc.use_namespaces,   "Use namespaces to ensure security (adds 30ms overhead, except --batch and --serve)"},
+    { "--cgroup",   "-g", PARSER_ARG_STR,  &proc.cgroup_root,      "Account and limit cpu time and memory with cgroup v2 created in dir"},
     { "--human",    "-h", PARSER_ARG_BOOL, &output_for_human,      "Use human-readable output"},
     { "--redirect-stdin",  "", PARSER_ARG_STR, &proc.redirect_stdin,  "Redirect stdin to file (after chroot and chdir)"},
     { "--redirect-stdout", "", PARSER_ARG_STR, &proc.redirect_stdout, "Redirect stdout to file (after chroot and chdir)"},
     { "--redirect-stderr", "", PARSER_ARG_STR, &proc.redirect_stderr, "Redirect stderr to file (after chroot and chdir)"},
+    { "--capture",      "", PARSER_ARG_BOOL, &proc.capture,       "Pass stdout and stderr through pipes drained by srun2"},
+    { "--output-limit", "", PARSER_ARG_LONG, &proc.limits.output, "Limit size of stdout and stderr (in Kbytes), implies --capture"},
+    { "--output-hash",  "", PARSER_ARG_BOOL, &proc.output_hash,   "Print hash of stdout after the report, implies --capture"},
+    { "--expect",       "", PARSER_ARG_STR,  &proc.expect,        "Compare stdout with expected answer in file, result is WA if it differs"},
+    { "--expect-exact", "", PARSER_ARG_BOOL, &proc.expect_exact,  "Stdout must be the same as --expect byte by byte, not only token by token"},
+    { "--expect-stop",  "", PARSER_ARG_BOOL, &proc.expect_stop,   "Kill the program at the first mismatch with --expect"},
+    { "--interactor",      "", PARSER_ARG_STR, &interactor_cmd,  "Run interactor command (split by spaces) with stdin and stdout connected to the program"},
+    { "--interactor-time", "", PARSER_ARG_INT, &interactor_time, "Limit user+system execution time of interactor (in ms, default: --time)"},
+    { "--interactor-mem",  "", PARSER_ARG_INT, &interactor_mem,  "Limit memory usage of interactor (in Kbytes, default: --mem)"},
+    { "--interactor-pipe", "", PARSER_ARG_INT, &interactor_pipe, "Size of pipes between program and interactor (in Kbytes, default: kernel's)"},
+    { "--batch",      "", PARSER_ARG_STR,  &batch_manifest, "Run command once for every test in manifest file"},
+    { "--batch-stop", "", PARSER_ARG_BOOL, &batch_stop,     "Stop --batch at the first test with result other than OK"},
+    { "--serve",         "", PARSER_ARG_STR, &serve_socket,  "Run as daemon serving requests on unix socket, no command is needed"},
+    { "--serve-workers", "", PARSER_ARG_INT, &serve_workers, "Max number of requests run at once by --serve (default: number of cpus)"},
+    { "--pool",          "", PARSER_ARG_INT, &pool_size,     "Keep that many children cloned and jailed in advance by --serve"},
+    { "--stdin-cache",   "", PARSER_ARG_INT, &stdin_cache,   "Keep --redirect-stdin files of that size in total (in Kbytes) in memory for next runs"},
+    { "--placement",          "", PARSER_ARG_BOOL, &placement,          "Pin every run to its own core and bind its memory to the core's NUMA node"},
+    { "--placement-idle-smt", "", PARSER_ARG_BOOL, &placement_idle_smt, "Keep SMT siblings of used cores idle, only one run per physical core"},
+    { "--calibration", "", PARSER_ARG_STR,  &calibration_file, "Scale time limits by speed of this machine from file, it is calibrated and saved there if missing"},
+    { "--calibrate",   "", PARSER_ARG_BOOL, &calibrate_now,    "Calibrate speed of this machine (saved to --calibration file if given), print it and exit"},
     { NULL }
 };
 
+/* Options of srun2 itself, tests of --batch and requests of --serve can't give them */
+static const char *global_options[] = {
+    "--images", "--syscall-profile", "--human", "--interactor", "--interactor-time", "--interactor-mem",
+    "--interactor-pipe", "--batch", "--batch-stop", "--serve", "--serve-workers", "--pool", "--stdin-cache",
+    "--placement", "--placement-idle-smt", "--calibration", "--calibrate", NULL
+};
+static parser_option_t run_options[sizeof(options) / sizeof(options[0])];
+
+void init_run_options() {
+    int count = 0;
+    for (parser_option_t *opt = options; opt->long_name; ++opt) {
+        const char **name = global_options;
+        while (*name && strcmp(*name, opt->long_name))
+            ++name;
+        if (!*name)
+            run_options[count++] = *opt;
+    }
+    run_options[count].long_name = NULL;
+}
+
 void help_and_exit(char *cmd) {
     fprintf(stderr, "Usage: %s [options] [--] command [arg1 arg2 ...]\n", cmd);
+    fprintf(stderr, "       %s [options] --serve socket\n", cmd);
     fprintf(stderr, "Securely runs command and prints report to stderr.\n\n");
 
     parser_print_help(options);
 
     fprintf(stderr, "\n--redirect-* options accept special value \"null\" to redirect stream to /dev/null\n");
     fprintf(stderr, "--redirect-stderr also accepts special value \"stdout\" to redirect stderr to stdout\n");
+    fprintf(stderr, "--seccomp-profile lists allowed syscalls, one per line with optional conditions on\n"
+                    "arguments, e.g. \"clone arg0 & 0x10000 == 0x10000\". It is used only with --seccomp\n"
+                    "and is compiled once, changes of the file are seen only by new srun2 processes\n");
+    fprintf(stderr, "--syscall-profile prints after the report \"SRUN_SYSCALL_FIRST: {name} {count}\" with the\n"
+                    "syscall that would be SV, then \"SRUN_SYSCALL: {name} {count}\" for every syscall outside of\n"
+                    "the profile, most used first. Profile \"none\" allows nothing, so all syscalls are counted.\n");
+    fprintf(stderr, "--max-* and --stack limits are enforced by kernel (setrlimit), they are not set by default\n"
+                    "except core dumps. Program that runs out of --max-as gets RE, or ML if it died of SIGSEGV or\n"
+                    "SIGABRT with address space seen within 2 MB of the limit. \"SRUN_ADDRESS_SPACE: {kb}\" with\n"
+                    "the peak seen is printed after the report.\n"
+                    "--max-procs counts all processes of the real user and isn't enforced for root.\n");
+    fprintf(stderr, "--capture writes output to --redirect-* files (opened by srun2 as the real user) or to\n"
+                    "stdout and stderr of srun2 itself. Output beyond --output-limit is OL and isn't written.\n"
+                    "Stderr is captured unless it goes to stdout or null. After the report it prints\n"
+                    "\"SRUN_OUTPUT: {bytes} {hash}\" with total size and 64-bit FNV-1a of stdout in hex,\n"
+                    "or \"-\" without --output-hash.\n");
+    fprintf(stderr, "--expect implies --capture, use \"--redirect-stdout null\" if output isn't needed.\n"
+                    "By default tokens separated by any whitespace are compared. After the report it prints\n"
+                    "\"SRUN_MISMATCH: {offset}\" with offset of the first byte of stdout that differs,\n"
+                    "or its size if it ended too early; -1 if it matches.\n");
+    fprintf(stderr, "--jail-ns doesn't need bind mounts of env_helper for every run: --chroot is a template,\n"
+                    "e.g. prepared by env_helper once, and all mounts of the run go away with it. Output files\n"
+                    "of --redirect-* are written through --capture, the jail itself is read-only.\n");
+    fprintf(stderr, "--jail-overlay root is reset for the next run by dropping its tmpfs, template must be a plain\n"
+                    "directory tree (overlayfs doesn't see mounts inside it). --images gives templates names\n"
+                    "and --serve keeps pool_size children of every image with overlay root ready for requests.\n");
+    fprintf(stderr, "--disk-quota limits tmpfs of --jail-scratch or --jail-overlay, writes beyond it fail with\n"
+                    "ENOSPC and the result is DL once usage above the quota is seen, it's checked every %d ms.\n"
+                    "When the tmpfs is known (Linux 5.2+), \"SRUN_DISK: {bytes}\" with its peak usage is printed\n"
+                    "after the report.\n", HYPERVISOR_DELAY / 1000);
+    fprintf(stderr, "--idle ends the run when cpu time of all its processes doesn't grow for that long,\n"
+                    "e.g. program waits for input that never comes or sleeps. It is checked every %d ms.\n",
+                    HYPERVISOR_DELAY / 1000);
+    fprintf(stderr, "--perf prints \"SRUN_PERF: {instructions} {cycles} {task_clock} {context_switches} {page_faults}\"\n"
+                    "after the report, summed over all processes of the run, task clock is in ns. Counters that\n"
+                    "aren't available are -1, hardware ones (instructions and cycles) are often missing in VMs,\n"
+                    "--instructions isn't enforced then. Instructions are checked every %d ms, like memory.\n",
+                    HYPERVISOR_DELAY / 1000);
+    fprintf(stderr, "--cgroup dir must be a cgroup v2 directory owned by the caller (delegated to it), a leaf is created there for each run\n");
 
     fprintf(stderr, "\nIf --human is not used, then output format is:\n");
     fprintf(stderr, "SRUN_REPORT: {string_result} {time} {real_time} {mem} {returncode}\n");
     fprintf(stderr, "\nwhere:\n"
-                    "  * {string_result} is one of \"OK\", \"RE\", \"TL\", \"ML\", \"SV\", \"SC\"\n"
+                    "  * {string_result} is one of \"OK\", \"RE\", \"TL\", \"ML\", \"SV\", \"SC\", \"OL\", \"IL\", \"WA\", \"DL\"\n"
                     "  * {time}, {real_time}, {mem} are time, wall time and memory used by the program\n"
+                    "    and all processes it has started. Without --cgroup {mem} is the larger of peak resident\n"
+                    "    size of the biggest process and sum of proportional set sizes (shared pages are split)\n"
+                    "    of all processes seen when sampling, with --cgroup it's peak of the cgroup\n"
                     "  * {returncode} is the program return code. A negative value -N indicates that\n"
                     "    the program was terminated by signal N\n");
+
+    fprintf(stderr, "\n\"SRUN_TASKS: {tasks}\" with the peak number of threads of all processes of the run follows the report.\n");
+    fprintf(stderr, "When the run is killed, e.g. for a limit, \"SRUN_KILL: {ms}\" is printed after the report\n"
+                    "with time from the kill until all processes of the run are gone.\n");
+
+    fprintf(stderr, "\nWith --interactor the report of the program has combined result: its own limits first,\n"
+                    "then WA if interactor has exited with non-zero code (SC if it has failed otherwise).\n"
+                    "Interactor runs in the same jail without seccomp, its stderr is stderr of srun2.\n"
+                    "After the report it prints \"SRUN_INTERACTOR: {result} {time} {real_time} {mem} {returncode}\"\n"
+                    "and \"SRUN_WAIT: {wait} {interactor_wait}\" with real time (in ms) both have slept,\n"
+                    "i.e. waited for each other.\n");
+
+    fprintf(stderr, "\n--batch manifest has one test per line: \"stdin_file stdout_file [options]\", where\n"
+                    "options override limits for this test and \"-\" keeps redirect of the command line.\n"
+                    "One report is printed for every test that was run.\n");
+
+    fprintf(stderr, "\nIn --serve mode requests are SOCK_SEQPACKET messages: uint32 id followed by\n"
+                    "NUL-terminated arguments of srun2 (without program name). Response is the same id\n"
+                    "followed by the report or \"SRUN_ERROR\". Options of the daemon are defaults for requests.\n"
+                    "Requests and tests of --batch can't give --images, --syscall-profile, --human, --interactor*,\n"
+                    "--batch*, --serve*, --pool, --stdin-cache, --placement* and --calibrat*.\n"
+                    "--pool children have jail (chroot and namespaces) of the daemon, requests with other\n"
+                    "jail are spawned as usual.\n"
+                    "Socket is created as the real user, only an old socket of this user is replaced.\n");
+
+    fprintf(stderr, "\n--batch and --serve create network, ipc and uts namespaces once and reuse them\n"
+                    "for runs one after another, only pid namespace is new for every run.\n");
+
+    fprintf(stderr, "\n--placement uses cpus srun2 is allowed to run on (see taskset), --serve runs at most one\n"
+                    "request per core (less with --serve-workers), others wait in the queue. After the report\n"
+                    "it prints \"SRUN_PLACEMENT: {cpu} {node}\", -1 if the run isn't pinned.\n");
+
+    fprintf(stderr, "\nWith --calibration, --time and --real-time are given for the reference machine and runs get\n"
+                    "them divided by speed of this one (above 1 if it is faster). Speed is the geometric mean\n"
+                    "over integer, memory latency and memory bandwidth kernels. After the report it prints\n"
+                    "\"SRUN_NORMALIZED: {time} {real_time}\", times of the run as they would be on the reference\n"
+                    "machine. --calibrate prints \"SRUN_CALIBRATION: {speed} {alu} {chase} {stream}\" with\n"
+                    "costs of kernels in ns per step.\n");
+
+    fprintf(stderr, "\nWith --stdin-cache, --redirect-stdin files are read once into sealed memory files\n"
+                    "and runs of --batch and --serve get them from memory while the file is unchanged.\n");
     exit(1);
 }
 
 void set_default_options(process_t *proc) {
     proc->jail.chdir = NULL;
     proc->jail.chroot = NULL;
+    proc->jail.mount_ns = false;
+    proc->jail.overlay = false;
+    proc->image = NULL;
+    proc->jail.scratch = 0;
+
+    // not set, limits of srun2 itself are inherited
+    proc->jail.rlimits.as = -1;
+    proc->jail.rlimits.stack = -1;
+    proc->jail.rlimits.files = -1;
+    proc->jail.rlimits.filesize = -1;
+    proc->jail.rlimits.procs = -1;
+    proc->jail.rlimits.core = 0;
 
     proc->limits.mem = 100*1024; // 100 Mbytes
     proc->limits.real_time = 4000; // 4 sec
     proc->limits.time = 2000; // 2 sec
+    proc->limits.idle = 0; // not limited
+    proc->limits.output = 0; // not limited
+    proc->limits.disk = 0; // not limited
+    proc->limits.instructions = 0; // not limited
 
     proc->redirect_stdin = NULL;
     proc->redirect_stdout = NULL;
     proc->redirect_stderr = NULL;
+    proc->stdin_fd = -1;
+    proc->stdout_fd = -1;
+    proc->capture = false;
+    proc->output_hash = false;
+    proc->expect = NULL;
+    proc->expect_exact = false;
+    proc->expect_stop = false;
 
     proc->use_seccomp = false;
+    proc->seccomp_profile = NULL;
+    proc->syscall_profile = NULL;
     proc->use_namespaces = true;
+    proc->use_perf = false;
+    proc->cgroup_root = NULL;
     proc->argv = NULL;
 }
 
-/* Very important function, also validates security */
-int validate_options(process_t *proc) {
+/* Redirect to a file, not "null" or "stdout" */
+bool is_file(const char *redirect) {
+    return redirect && strcmp(redirect, "null") && strcmp(redirect, "stdout");
+}
+
+/** Sets jail of the run to overlay of image. @return -1 if there is no such image */
+int apply_image(process_t *proc, const char *name) {
+    const image_t *image = image_find(name);
+    if (!image) {
+        ERROR("Unknown image %s", name);
+        return -1;
+    }
+    proc->jail.chroot = strdup(image->root);
+    proc->jail.mount_ns = true;
+    proc->jail.overlay = true;
+    return 0;
+}
+
+/* Very important function, also validates security. Options of the daemon have no program, requests bring it */
+int validate_options(process_t *proc, bool needs_program) {
     if (proc->limits.mem < 1) {
         ERROR("Memory limit is too small");
         return -1;
@@ -94,7 +311,54 @@ int validate_options(process_t *proc) {
         return -1;
     }
 
-    if (!proc->argv[0]) {
+    if (proc->limits.idle < 0) {
+        ERROR("Idleness limit can't be negative");
+        return -1;
+    }
+
+    if (proc->limits.output < 0) {
+        ERROR("Output limit can't be negative");
+        return -1;
+    }
+    if (proc->limits.output > 0 || proc->output_hash || proc->expect)
+        proc->capture = true;
+
+    if (proc->limits.instructions < 0) {
+        ERROR("Instructions limit can't be negative");
+        return -1;
+    }
+    if (proc->limits.instructions > 0)
+        proc->use_perf = true;
+
+    if (proc->image && apply_image(proc, proc->image) == -1)
+        return -1;
+    if (proc->jail.overlay)
+        proc->jail.mount_ns = true;
+
+    if (proc->jail.mount_ns && !proc->jail.chroot) {
+        ERROR("--jail-ns needs --chroot with the template of jail");
+        return -1;
+    }
+    if (proc->jail.scratch < 0 || (proc->jail.scratch > 0 && !proc->jail.mount_ns)) {
+        ERROR("--jail-scratch must be non-negative and is used only with --jail-ns");
+        return -1;
+    }
+    if (proc->limits.disk < 0 || (proc->limits.disk > 0 && !proc->jail.mount_ns)) {
+        ERROR("--disk-quota must be non-negative and is used only with --jail-ns");
+        return -1;
+    }
+    if (proc->limits.disk > 0)
+        proc->jail.scratch = proc->limits.disk + sysconf(_SC_PAGESIZE) / 1024; //one block above the quota, see check_disk
+    // jail is read-only, so output files are written by srun2 into the template
+    if (proc->jail.mount_ns && (is_file(proc->redirect_stdout) || is_file(proc->redirect_stderr)))
+        proc->capture = true;
+
+    if (proc->use_seccomp && !prepare_seccomp(proc->seccomp_profile, false)) {
+        ERROR("Can't use seccomp profile %s", proc->seccomp_profile ? proc->seccomp_profile : "default");
+        return -1;
+    }
+
+    if (needs_program && !proc->argv[0]) {
         ERROR("No program to run");
         return -1;
     }
@@ -120,6 +384,32 @@ void print_stats_for_human(FILE *stream, process_t *proc) {
     fprintf(stream, "Time:      %10ld (ms)\n", proc->stats.time);
     fprintf(stream, "Real Time: %10ld (ms)\n", proc->stats.real_time);
     fprintf(stream, "Memory:    %10ld (kB)\n", proc->stats.mem);
+    fprintf(stream, "Tasks:     %10d\n", proc->stats.tasks);
+    if (proc->stats.kill_latency != -1)
+        fprintf(stream, "Kill:      %10ld (ms)\n", proc->stats.kill_latency);
+    if (proc->jail.rlimits.as > 0)
+        fprintf(stream, "Addr Space:%10ld (kB)\n", proc->stats.vm_peak);
+    if (proc->capture)
+        fprintf(stream, "Output:    %10lld (bytes)\n", proc->stats.output);
+    if (proc->output_hash)
+        fprintf(stream, "Hash:      %016llx\n", proc->stats.output_hash);
+    if (proc->expect && proc->stats.mismatch != -1)
+        fprintf(stream, "Mismatch:  %10lld (byte)\n", proc->stats.mismatch);
+    if (placement_enabled())
+        fprintf(stream, "Cpu:       %10d (node %d)\n", proc->placement.cpu, proc->placement.node);
+    if (proc->stats.disk != -1)
+        fprintf(stream, "Disk:      %10lld (bytes)\n", proc->stats.disk);
+    if (calibration_enabled()) {
+        fprintf(stream, "Norm Time: %10ld (ms)\n", calibration_normalize(proc->stats.time));
+        fprintf(stream, "Norm Real: %10ld (ms)\n", calibration_normalize(proc->stats.real_time));
+    }
+    if (proc->use_perf) {
+        fprintf(stream, "Instrs:    %10lld\n", proc->stats.perf[PERF_INSTRUCTIONS]);
+        fprintf(stream, "Cycles:    %10lld\n", proc->stats.perf[PERF_CYCLES]);
+        fprintf(stream, "Task Clock:%10lld (ns)\n", proc->stats.perf[PERF_TASK_CLOCK]);
+        fprintf(stream, "Switches:  %10lld\n", proc->stats.perf[PERF_CONTEXT_SWITCHES]);
+        fprintf(stream, "Faults:    %10lld\n", proc->stats.perf[PERF_PAGE_FAULTS]);
+    }
     fprintf(stream, "Status:  ");
     print_exit_status(stream, proc->stats.status);
 }
@@ -148,25 +438,248 @@ void print_stats(FILE *stream, process_t *proc) {
             proc->stats.real_time,
             proc->stats.mem,
             returncode);
+    fprintf(stream, "SRUN_TASKS: %d\n", proc->stats.tasks);
+    if (proc->stats.kill_latency != -1)
+        fprintf(stream, "SRUN_KILL: %ld\n", proc->stats.kill_latency);
+    if (proc->jail.rlimits.as > 0)
+        fprintf(stream, "SRUN_ADDRESS_SPACE: %ld\n", proc->stats.vm_peak);
+    if (proc->expect)
+        fprintf(stream, "SRUN_MISMATCH: %lld\n", proc->stats.mismatch);
+    if (proc->output_hash)
+        fprintf(stream, "SRUN_OUTPUT: %lld %016llx\n", proc->stats.output, proc->stats.output_hash);
+    else if (proc->capture)
+        fprintf(stream, "SRUN_OUTPUT: %lld -\n", proc->stats.output);
+    if (placement_enabled())
+        fprintf(stream, "SRUN_PLACEMENT: %d %d\n", proc->placement.cpu, proc->placement.node);
+    if (proc->stats.disk != -1)
+        fprintf(stream, "SRUN_DISK: %lld\n", proc->stats.disk);
+    if (calibration_enabled())
+        fprintf(stream, "SRUN_NORMALIZED: %ld %ld\n",
+                calibration_normalize(proc->stats.time),
+                calibration_normalize(proc->stats.real_time));
+    if (proc->use_perf)
+        fprintf(stream, "SRUN_PERF: %lld %lld %lld %lld %lld\n",
+                proc->stats.perf[PERF_INSTRUCTIONS],
+                proc->stats.perf[PERF_CYCLES],
+                proc->stats.perf[PERF_TASK_CLOCK],
+                proc->stats.perf[PERF_CONTEXT_SWITCHES],
+                proc->stats.perf[PERF_PAGE_FAULTS]);
+}
+
+void print_report(FILE *stream, process_t *proc) {
+    if (output_for_human)
+        print_stats_for_human(stream, proc);
+    else
+        print_stats(stream, proc);
+}
+
+void print_interactor_report(FILE *stream, process_t *proc, process_t *interactor) {
+    if (output_for_human) {
+        fprintf(stream, "Wait:      %10ld (ms)\n", proc->stats.wait_time);
+        fprintf(stream, "\nInteractor:\n");
+        print_stats_for_human(stream, interactor);
+        fprintf(stream, "Wait:      %10ld (ms)\n", interactor->stats.wait_time);
+        return;
+    }
+
+    fprintf(stream, "SRUN_INTERACTOR: %s %ld %ld %ld %d\n",
+            result_to_str[interactor->stats.result],
+            interactor->stats.time,
+            interactor->stats.real_time,
+            interactor->stats.mem,
+            returncode_from_status(interactor->stats.status));
+    fprintf(stream, "SRUN_WAIT: %ld %ld\n", proc->stats.wait_time, interactor->stats.wait_time);
+}
+
+/* Interactor is a copy of the program's options with its own command and limits */
+int prepare_interactor(process_t *proc, process_t *interactor) {
+    if (proc->capture || proc->redirect_stdin || proc->redirect_stdout) {
+        ERROR("--interactor owns stdin and stdout of the program, they can't be redirected or captured");
+        return -1;
+    }
+    if (interactor_time < 0 || interactor_mem < 0 || interactor_pipe < 0) {
+        ERROR("Limits of interactor can't be negative");
+        return -1;
+    }
+
+    *interactor = *proc;
+    if (interactor_time)
+        interactor->limits.time = calibration_scale(interactor_time);
+    if (interactor_mem)
+        interactor->limits.mem = interactor_mem;
+    interactor->limits.idle = 0; // it waits for the program most of the time
+    interactor->use_seccomp = false;
+    interactor->redirect_stderr = NULL;
+    interactor->syscall_profile = NULL;
+
+    int argc = 0;
+    char **argv = (char **) malloc((strlen(interactor_cmd) / 2 + 2) * sizeof(char *));
+    for (char *arg = strtok(interactor_cmd, " "); arg; arg = strtok(NULL, " "))
+        argv[argc++] = arg;
+    argv[argc] = NULL;
+    interactor->argv = argv;
+    if (!argc) {
+        ERROR("No interactor to run");
+        return -1;
+    }
+
+    return interactor_connect(proc, interactor, interactor_pipe);
 }
 
-void run(process_t *proc) {
+/* Time limits are given for the reference machine, validated options get them as they are on this one */
+void normalize_limits(process_t *proc) {
+    proc->limits.time = calibration_scale(proc->limits.time);
+    proc->limits.real_time = calibration_scale(proc->limits.real_time);
+}
+
+int run(process_t *proc) {
     if (spawn_process(proc) == -1)
-        exit(1);
+        return -1;
     hypervisor(proc);
+    release_process(proc);
+    return 0;
+}
+
+char **copy_argv(char **argv) {
+    int argc = 0;
+    while (argv[argc])
+        ++argc;
+
+    char **copy = (char **) malloc((argc + 1) * sizeof(char *));
+    for (int i = 0; i < argc; ++i)
+        copy[i] = strdup(argv[i]);
+    copy[argc] = NULL;
+    return copy;
+}
+
+void destroy_request(process_t *req) {
+    // string options of the request are strdup'ed by parser, ones of the daemon are shared
+#define FREE_OWN_OPTION(field) if (req->field != base_proc.field) free(req->field)
+    FREE_OWN_OPTION(jail.chroot);
+    FREE_OWN_OPTION(jail.chdir);
+    FREE_OWN_OPTION(redirect_stdin);
+    FREE_OWN_OPTION(redirect_stdout);
+    FREE_OWN_OPTION(redirect_stderr);
+    FREE_OWN_OPTION(cgroup_root);
+    FREE_OWN_OPTION(seccomp_profile);
+    FREE_OWN_OPTION(expect);
+    FREE_OWN_OPTION(image);
+#undef FREE_OWN_OPTION
+
+    for (char **arg = req->argv; *arg; ++arg)
+        free(*arg);
+    free(req->argv);
+    free(req);
+}
+
+/* Request of --serve mode, parsed over the options of the daemon */
+process_t *create_request(int argc, char **argv) {
+    proc = base_proc;
+    int idx = parse_options(run_options, argc, argv);
+    if (idx == -1)
+        return NULL;
+    proc.argv = &argv[idx];
+    if (-1 == validate_options(&proc, true))
+        return NULL;
+    normalize_limits(&proc);
+
+    process_t *req = (process_t *) malloc(sizeof(process_t));
+    *req = proc;
+    req->argv = copy_argv(proc.argv);
+    return req;
+}
+
+static const server_handlers_t request_handlers = { create_request, print_report, destroy_request };
+
+/* Test of --batch mode */
+int handle_test(int argc, char **argv) {
+    proc = base_proc;
+    if (parse_options(run_options, argc, argv) != argc) {
+        ERROR("Unexpected arguments for test");
+        return -1;
+    }
+
+    if (-1 == validate_options(&proc, true))
+        return -1;
+    normalize_limits(&proc);
+    if (-1 == run(&proc))
+        return -1;
+
+    print_report(stderr, &proc);
+    return proc.stats.result;
 }
 
 int main(int argc, char *argv[]) {
     set_default_options(&proc);
+    init_run_options();
 
     int idx = parse_options(options, argc, argv);
     if (idx == -1)
         help_and_exit(argv[0]);
     proc.argv = &argv[idx];
 
-    if (-1 == validate_options(&proc))
+    if (stdin_cache < 0) {
+        ERROR("--stdin-cache must be non-negative");
+        help_and_exit(argv[0]);
+    }
+    input_cache_init(stdin_cache);
+    if (images_file && images_load(images_file) == -1)
+        return 1;
+    if (placement && placement_init(placement_idle_smt) == -1)
+        return 1;
+    if ((calibration_file || calibrate_now) && calibration_init(calibration_file, calibrate_now) == -1)
+        return 1;
+    if (calibrate_now) {
+        calibration_print(stderr);
+        return 0;
+    }
+
+    if (serve_socket && syscall_profile_mode) {
+        ERROR("--syscall-profile can't be used with --serve");
+        return 1;
+    }
+
+    if (interactor_cmd && (serve_socket || batch_manifest)) {
+        ERROR("--interactor can't be used with --serve or --batch");
+        return 1;
+    }
+
+    if (serve_socket) {
+        if (serve_workers < 1)
+            serve_workers = placement ? placement_slots() : sysconf(_SC_NPROCESSORS_ONLN);
+        if (-1 == validate_options(&proc, false))
+            help_and_exit(argv[0]);
+        base_proc = proc;
+        ns_pool_init(serve_workers);
+        if (pool_size > 0)
+            pool_init(&base_proc, pool_size);
+        for (int i = 0; i < images_count(); ++i) {
+            const image_t *image = image_get(i);
+            process_t image_base = base_proc;
+            if (image->pool > 0 && apply_image(&image_base, image->name) == 0)
+                pool_init(&image_base, image->pool);
+        }
+        return serve(serve_socket, serve_workers, &request_handlers) == -1 ? 1 : 0;
+    }
+
+    if (-1 == validate_options(&proc, true))
         help_and_exit(argv[0]);
 
+    if (syscall_profile_mode) {
+        if (batch_manifest) {
+            ERROR("--syscall-profile can't be used with --batch");
+            return 1;
+        }
+        proc.syscall_profile = &syscall_profile;
+    }
+
+    if (batch_manifest) {
+        base_proc = proc;
+        ns_pool_init(1);
+        return run_batch(batch_manifest, batch_stop, handle_test) == -1 ? 1 : 0;
+    }
+
+    normalize_limits(&proc);
     DEBUG("Current limits:\n"
               "real time = %d ms\n"
               "time = %d ms\n"
@@ -175,12 +688,18 @@ int main(int argc, char *argv[]) {
               proc.limits.time,
               proc.limits.mem);
 
-    run(&proc);
+    if (interactor_cmd) {
+        if (-1 == prepare_interactor(&proc, &interactor) || -1 == run_interactive(&proc, &interactor))
+            exit(1);
+    } else if (-1 == run(&proc)) {
+        exit(1);
+    }
 
-    if (output_for_human)
-        print_stats_for_human(stderr, &proc);
-    else
-        print_stats(stderr, &proc);
+    print_report(stderr, &proc);
+    if (interactor_cmd)
+        print_interactor_report(stderr, &proc, &interactor);
+    if (proc.syscall_profile)
+        syscall_profile_print(stderr, proc.syscall_profile);
 
     return 0;
 }
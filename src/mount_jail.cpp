@@ -0,0 +1,196 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "mount_jail.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+
+#ifndef SYS_mount_setattr
+#define SYS_move_mount 429
+#define SYS_fsopen 430
+#define SYS_fsconfig 431
+#define SYS_fsmount 432
+#define SYS_mount_setattr 442
+#endif
+
+#ifndef MOUNT_ATTR_SIZE_VER0 // before glibc 2.36
+#define MOUNT_ATTR_RDONLY 0x00000001
+#define MOUNT_ATTR_NOSUID 0x00000002
+#define MOUNT_ATTR_NODEV 0x00000004
+#define MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#define FSOPEN_CLOEXEC 0x00000001
+#define FSMOUNT_CLOEXEC 0x00000001
+#define FSCONFIG_SET_STRING 1
+#define FSCONFIG_CMD_CREATE 6
+struct mount_attr {
+    unsigned long long attr_set;
+    unsigned long long attr_clr;
+    unsigned long long propagation;
+    unsigned long long userns_fd;
+};
+#endif
+
+/*
+ * Jail built by the child itself in its own mount namespace, instead of chroot into a directory
+ * with bind mounts made by env_helper for every run:
+ *   - chroot dir (template) is bind-mounted read-only over itself with all mounts under it;
+ *   - size-limited tmpfs is mounted at JAIL_SCRATCH_DIR of it, if --jail-scratch is set;
+ *   - pivot_root makes it the root, old root is detached.
+ * With overlay the template is the lower layer of overlayfs instead and the upper one is on tmpfs,
+ * so the whole root is writable and is reset for the next run by dropping the tmpfs with namespace.
+ * Mounts are private to the namespace, they aren't propagated to host and go away with the run.
+ *
+ * Tmpfs is created by the parent detached from any namespace (fsopen, fsmount) and moved into the jail
+ * by the child, so the parent keeps fd of it and sees how much is written even after the run is gone.
+ * Its size is one block above --disk-quota, writes beyond it fail with ENOSPC and usage above the quota is DL.
+ */
+
+void jail_mount(const char *source, const char *target, const char *type, unsigned long flags, const char *data) {
+    if (mount(source, target, type, flags, data) == -1) {
+        SYSERROR("can't mount %s", target);
+        abort();
+    }
+}
+
+/* Recursively, mount_setattr() is since Linux 5.12, before it only the template itself is read-only */
+void make_readonly(const char *path) {
+    struct mount_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.attr_set = MOUNT_ATTR_RDONLY | MOUNT_ATTR_NOSUID;
+    if (syscall(SYS_mount_setattr, AT_FDCWD, path, AT_RECURSIVE, &attr, sizeof(attr)) == 0)
+        return;
+    TRACE("mount_setattr failed: %s", strerror(errno));
+    jail_mount(NULL, path, NULL, MS_REMOUNT | MS_BIND | MS_RDONLY | MS_NOSUID, NULL);
+}
+
+/** Called in parent. @return fd of detached tmpfs for jail, -1 if kernel can't do it (before Linux 5.2) */
+int create_scratch(const jail_t *jail) {
+    if (!jail->mount_ns || (!jail->overlay && jail->scratch <= 0))
+        return -1;
+
+    int fs_fd = syscall(SYS_fsopen, "tmpfs", FSOPEN_CLOEXEC);
+    if (fs_fd == -1) {
+        TRACE("fsopen failed: %s", strerror(errno));
+        return -1;
+    }
+
+    char size[32];
+    snprintf(size, sizeof(size), "%ldk", jail->scratch);
+    int fd = -1;
+    if ((jail->scratch <= 0 || syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_STRING, "size", size, 0) == 0)
+            && syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_STRING, "mode", "1777", 0) == 0
+            && syscall(SYS_fsconfig, fs_fd, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == 0)
+        fd = syscall(SYS_fsmount, fs_fd, FSMOUNT_CLOEXEC, MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV);
+    if (fd == -1)
+        SYSWARN("can't create tmpfs for jail, disk usage won't be known");
+    close(fs_fd);
+    return fd;
+}
+
+/** @return bytes used in tmpfs of jail, -1 on error; full is set if nothing more can be written */
+long long get_scratch_usage(int scratch_fd) {
+    struct statfs st;
+    if (fstatfs(scratch_fd, &st) == -1)
+        return -1;
+    return (long long) (st.f_blocks - st.f_bfree) * st.f_bsize;
+}
+
+void mount_scratch(const char *path, long size, int scratch_fd) {
+    if (scratch_fd != -1) {
+        if (syscall(SYS_move_mount, scratch_fd, "", AT_FDCWD, path, MOVE_MOUNT_F_EMPTY_PATH) == -1) {
+            SYSERROR("can't move tmpfs to %s", path);
+            abort();
+        }
+        return;
+    }
+
+    char options[64] = "mode=1777";
+    if (size > 0)
+        snprintf(options, sizeof(options), "size=%ldk,mode=1777", size);
+    jail_mount("tmpfs", path, "tmpfs", MS_NOSUID | MS_NODEV, options);
+}
+
+/*
+ * Tmpfs is mounted over the template itself, it's hidden then, but still reachable through fd.
+ * Overlayfs doesn't see mounts inside the template, it must be a plain directory tree.
+ * @return new root
+ */
+const char *mount_overlay(const jail_t *jail, int scratch_fd) {
+    int template_fd = open(jail->chroot, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (template_fd == -1) {
+        SYSERROR("can't open template %s", jail->chroot);
+        abort();
+    }
+    mount_scratch(jail->chroot, jail->scratch, scratch_fd);
+
+    static char root[PATH_MAX];
+    char upper[PATH_MAX], work[PATH_MAX], options[3 * PATH_MAX];
+    snprintf(root, sizeof(root), "%s/root", jail->chroot);
+    snprintf(upper, sizeof(upper), "%s/upper", jail->chroot);
+    snprintf(work, sizeof(work), "%s/work", jail->chroot);
+    if (mkdir(root, 0755) == -1 || mkdir(upper, 0755) == -1 || mkdir(work, 0755) == -1) {
+        SYSERROR("can't create overlay dirs");
+        abort();
+    }
+
+    snprintf(options, sizeof(options), "lowerdir=/proc/self/fd/%d,upperdir=%s,workdir=%s", template_fd, upper, work);
+    jail_mount("overlay", root, "overlay", MS_NOSUID, options);
+    close(template_fd);
+    return root;
+}
+
+/* Called in child instead of chroot, while it is still root */
+void enter_mount_jail(const jail_t *jail, int scratch_fd) {
+    if (unshare(CLONE_NEWNS) == -1) {
+        SYSERROR("can't create mount namespace");
+        abort();
+    }
+    jail_mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL);
+
+    const char *root = jail->chroot;
+    if (jail->overlay) {
+        root = mount_overlay(jail, scratch_fd);
+    } else {
+        jail_mount(jail->chroot, jail->chroot, NULL, MS_BIND | MS_REC, NULL);
+        make_readonly(jail->chroot);
+
+        if (jail->scratch > 0) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s" JAIL_SCRATCH_DIR, jail->chroot);
+            mount_scratch(path, jail->scratch, scratch_fd);
+        }
+    }
+
+    // old root is stacked over the new one, see pivot_root(2)
+    if (chdir(root) == -1 || syscall(SYS_pivot_root, ".", ".") == -1 || umount2(".", MNT_DETACH) == -1) {
+        SYSERROR("can't pivot root to %s", root);
+        abort();
+    }
+    if (chdir("/") == -1)
+        SYSERROR("can't chdir after pivot_root");
+}
@@ -0,0 +1,30 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef MOUNT_JAIL_H_
+#define MOUNT_JAIL_H_
+
+#include "process.h"
+
+/* Mount point of --jail-scratch inside the jail */
+#define JAIL_SCRATCH_DIR "/tmp"
+
+int create_scratch(const jail_t *jail);
+long long get_scratch_usage(int scratch_fd);
+void enter_mount_jail(const jail_t *jail, int scratch_fd);
+
+#endif /* MOUNT_JAIL_H_ */
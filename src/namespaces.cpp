@@ -0,0 +1,292 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "namespaces.h"
+#include "spawn.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/sem.h>
+#include <sys/msg.h>
+
+/*
+ * Creating network namespace (and destroying it in kernel afterwards) is what
+ * makes --usens slow. So network, ipc and uts namespaces are created once, held by fds
+ * and entered with setns() by the child, pid namespace is still created by clone for every run.
+ *
+ * Namespace is given to the next run only after all processes of the previous one are
+ * dead (pid namespace guarantees that when its init is reaped). What could be left:
+ *   - network: nothing, loopback is down and jailed program has no caps to change it;
+ *   - uts: nothing, hostname can't be changed without caps;
+ *   - ipc: System V objects, removed by the next child before it drops privileges,
+ *     and POSIX message queues, which can't be listed, so program is not allowed to create them.
+ *
+ * Program is not init of its pid namespace: init gets only signals it has handlers for, so it would
+ * survive SIGXFSZ, SIGXCPU and even its own abort(). Init is a tiny separate process instead,
+ * program is cloned by us into its namespace (setns to pid_for_children), so it is still our child.
+ * Killing init kills everything left in the namespace.
+ */
+
+#define NS_COUNT 3
+
+static const int ns_types[NS_COUNT] = { CLONE_NEWNET, CLONE_NEWIPC, CLONE_NEWUTS };
+static const char * const ns_names[NS_COUNT] = { "net", "ipc", "uts" };
+
+static bool pool_enabled = false;
+static namespaces_t *idle = NULL;
+static int idle_count = 0, idle_max = 0;
+
+int *ns_fd(namespaces_t *ns, int i) {
+    int *fds[NS_COUNT] = { &ns->net_fd, &ns->ipc_fd, &ns->uts_fd };
+    return fds[i];
+}
+
+/* Namespaces are reused only if pool is enabled, then at most max_idle of them are kept between runs */
+void ns_pool_init(int max_idle) {
+    idle = (namespaces_t *) malloc(max_idle * sizeof(namespaces_t));
+    idle_max = max_idle;
+    idle_count = 0;
+    pool_enabled = true;
+}
+
+bool ns_pool_enabled() {
+    return pool_enabled;
+}
+
+void ns_init(namespaces_t *ns) {
+    for (int i = 0; i < NS_COUNT; ++i)
+        *ns_fd(ns, i) = -1;
+    ns->pid_init = -1;
+}
+
+void close_namespaces(namespaces_t *ns) {
+    for (int i = 0; i < NS_COUNT; ++i) {
+        if (*ns_fd(ns, i) != -1)
+            close(*ns_fd(ns, i));
+        *ns_fd(ns, i) = -1;
+    }
+}
+
+/* Lives in new namespaces until parent opens them and closes the pipe */
+int hold_namespaces(void *_pipe) {
+    int *pipe_fds = (int *) _pipe;
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    close(pipe_fds[1]);
+    char c;
+    while (read(pipe_fds[0], &c, 1) == -1 && errno == EINTR)
+        ;
+    return 0;
+}
+
+int create_namespaces(namespaces_t *ns) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        SYSERROR("can't create pipe");
+        return -1;
+    }
+
+    pid_t pid = saferun_clone(hold_namespaces, pipe_fds, CLONE_NEWNET | CLONE_NEWIPC | CLONE_NEWUTS);
+    if (pid < 0) {
+        SYSERROR("can't clone process for new namespaces");
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return -1;
+    }
+
+    int ret = 0;
+    char path[PATH_MAX];
+    for (int i = 0; i < NS_COUNT; ++i) {
+        snprintf(path, PATH_MAX, "/proc/%d/ns/%s", pid, ns_names[i]);
+        *ns_fd(ns, i) = open(path, O_RDONLY | O_CLOEXEC);
+        if (*ns_fd(ns, i) == -1) {
+            SYSERROR("can't open %s", path);
+            ret = -1;
+        }
+    }
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]); //holder exits
+    waitpid(pid, NULL, 0);
+
+    if (ret == -1) {
+        close_namespaces(ns);
+    } else {
+        TRACE("created namespaces, net fd %d", ns->net_fd);
+    }
+    return ret;
+}
+
+/** Takes idle namespaces or creates new ones. @return -1 on error */
+int ns_acquire(namespaces_t *ns) {
+    if (idle_count) {
+        *ns = idle[--idle_count];
+        return 0;
+    }
+    return create_namespaces(ns);
+}
+
+/* Kills what is left of the run, then namespaces can be reused */
+void ns_release(namespaces_t *ns) {
+    if (ns->pid_init != -1) {
+        kill(ns->pid_init, SIGKILL);
+        waitpid(ns->pid_init, NULL, 0);
+        ns->pid_init = -1;
+    }
+
+    if (ns->net_fd == -1)
+        return;
+
+    if (idle_count < idle_max) {
+        idle[idle_count++] = *ns;
+        ns_init(ns);
+    } else {
+        close_namespaces(ns);
+    }
+}
+
+void sigchld_handler(int) {
+}
+
+/* Init of run's pid namespace, reaps orphans until it is killed */
+int pid_namespace_init(void *) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    syscall(SYS_close_range, 3, ~0U, 0); //don't keep copies of our fds, e.g. sockets of clients
+
+    sigset_t mask, wait_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &wait_mask);
+    sigdelset(&wait_mask, SIGCHLD);
+    signal(SIGCHLD, sigchld_handler);
+
+    while (1) {
+        while (waitpid(-1, NULL, WNOHANG) > 0)
+            ;
+        sigsuspend(&wait_mask);
+    }
+    return 0;
+}
+
+/** Creates pid namespace, our next children are cloned into it. @return -1 on error */
+int ns_start_pid_namespace(namespaces_t *ns) {
+    ns->pid_init = saferun_clone(pid_namespace_init, NULL, CLONE_NEWPID);
+    if (ns->pid_init < 0) {
+        SYSERROR("can't clone init of pid namespace");
+        ns->pid_init = -1;
+        return -1;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "/proc/%d/ns/pid", ns->pid_init);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || setns(fd, CLONE_NEWPID) == -1) {
+        SYSERROR("can't enter pid namespace of %d", ns->pid_init);
+        if (fd != -1)
+            close(fd);
+        kill(ns->pid_init, SIGKILL);
+        waitpid(ns->pid_init, NULL, 0);
+        ns->pid_init = -1;
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+/* Our next children are in our own pid namespace again */
+void ns_leave_pid_namespace() {
+    int fd = open("/proc/self/ns/pid", O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || setns(fd, CLONE_NEWPID) == -1) {
+        SYSERROR("can't return to own pid namespace");
+        abort(); //every next run would be in a namespace of dead init
+    }
+    close(fd);
+}
+
+union semun {
+    int val;
+    struct semid_ds *buf;
+    unsigned short *array;
+    struct seminfo *__buf;
+};
+
+/* Removes System V ipc objects left by previous runs in current ipc namespace */
+void remove_sysv_ipc() {
+    struct shm_info shm_info;
+    struct shmid_ds shm;
+    int max = shmctl(0, SHM_INFO, (struct shmid_ds *) &shm_info);
+    for (int i = 0; i <= max; ++i) {
+        int id = shmctl(i, SHM_STAT, &shm);
+        if (id != -1 && shmctl(id, IPC_RMID, NULL) == -1)
+            SYSWARN("can't remove shared memory segment %d", id);
+    }
+
+    struct seminfo sem_info;
+    struct semid_ds sem;
+    union semun arg;
+    arg.__buf = &sem_info;
+    max = semctl(0, 0, SEM_INFO, arg);
+    arg.buf = &sem;
+    for (int i = 0; i <= max; ++i) {
+        int id = semctl(i, 0, SEM_STAT, arg);
+        if (id != -1 && semctl(id, 0, IPC_RMID) == -1)
+            SYSWARN("can't remove semaphore set %d", id);
+    }
+
+    struct msginfo msg_info;
+    struct msqid_ds msg;
+    max = msgctl(0, MSG_INFO, (struct msqid_ds *) &msg_info);
+    for (int i = 0; i <= max; ++i) {
+        int id = msgctl(i, MSG_STAT, &msg);
+        if (id != -1 && msgctl(id, IPC_RMID, NULL) == -1)
+            SYSWARN("can't remove message queue %d", id);
+    }
+}
+
+/* Called in child, while it is still privileged */
+void ns_enter(namespaces_t *ns) {
+    if (ns->net_fd == -1)
+        return;
+
+    for (int i = 0; i < NS_COUNT; ++i) {
+        if (setns(*ns_fd(ns, i), ns_types[i]) == -1) {
+            SYSERROR("can't enter %s namespace", ns_names[i]);
+            abort();
+        }
+    }
+    close_namespaces(ns);
+
+    remove_sysv_ipc();
+
+    struct rlimit rl;
+    rl.rlim_cur = rl.rlim_max = 0;
+    if (setrlimit(RLIMIT_MSGQUEUE, &rl) == -1) {
+        SYSERROR("can't set RLIMIT_MSGQUEUE");
+        abort();
+    }
+}
@@ -0,0 +1,33 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef NAMESPACES_H_
+#define NAMESPACES_H_
+
+#include "process.h"
+
+void ns_pool_init(int max_idle);
+bool ns_pool_enabled();
+
+void ns_init(namespaces_t *ns);
+int ns_acquire(namespaces_t *ns);
+void ns_enter(namespaces_t *ns);
+void ns_release(namespaces_t *ns);
+
+int ns_start_pid_namespace(namespaces_t *ns);
+void ns_leave_pid_namespace();
+
+#endif /* NAMESPACES_H_ */
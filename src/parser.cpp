@@ -57,6 +57,41 @@ int parse_int(parser_option_t *option, char *arg) {
     return 0;
 }
 
+int parse_long(parser_option_t *option, char *arg) {
+    errno = 0;
+    char *end;
+    long res = strtol(arg, &end, 0);
+
+    if (arg[0] == '\0' || end[0] != '\0') {
+        ERROR("Argument for ""%s"" is not a valid integer value",  option->long_name);
+        return -1;
+    }
+
+    if (errno == ERANGE) {
+        ERROR("Argument for ""%s"" is outside of integer range", option->long_name);
+        return -1;
+    }
+
+    *((long *)option->variable) = res;
+    return 0;
+}
+
+int parse_limit(parser_option_t *option, char *arg) {
+    if (!strcmp("unlimited", arg)) {
+        *((int *)option->variable) = PARSER_UNLIMITED;
+        return 0;
+    }
+
+    if (parse_int(option, arg))
+        return -1;
+
+    if (*((int *)option->variable) < 0) {
+        ERROR("Argument for ""%s"" must be non-negative or \"unlimited\"", option->long_name);
+        return -1;
+    }
+    return 0;
+}
+
 int parse_bool(parser_option_t *option, char *arg) {
     if (!strcmp("1", arg) || !strcmp("on", arg) ) {
         *((bool *)option->variable) = true;
@@ -77,10 +112,14 @@ int parse_option(parser_option_t *option, char *arg) {
     switch (option->type) {
         case PARSER_ARG_INT:
             return parse_int(option, arg);
+        case PARSER_ARG_LONG:
+            return parse_long(option, arg);
         case PARSER_ARG_BOOL:
             return parse_bool(option, arg);
         case PARSER_ARG_STR:
             return parse_str(option, arg);
+        case PARSER_ARG_LIMIT:
+            return parse_limit(option, arg);
         default:
             ERROR("Unknown option type for ""%s""", option->long_name);
             return -1;
@@ -20,9 +20,14 @@
 typedef enum parser_arg_t {
     PARSER_ARG_STR  = 1,
     PARSER_ARG_INT  = 2,
-    PARSER_ARG_BOOL = 3
+    PARSER_ARG_BOOL = 3,
+    PARSER_ARG_LIMIT = 4, /**< non-negative int or "unlimited" */
+    PARSER_ARG_LONG = 5
 } parser_arg_t;
 
+/* Value of PARSER_ARG_LIMIT option given as "unlimited" */
+#define PARSER_UNLIMITED -2
+
 typedef struct parser_option_t {
     char *long_name;
     char *short_name;
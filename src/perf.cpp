@@ -0,0 +1,147 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "perf.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/*
+ * Cost of the run counted by perf_event, it doesn't depend on frequency scaling and
+ * neighbours as much as cpu time does. Counters are opened by parent on the child before
+ * exec, disabled until exec and inherited by all processes and threads the program starts,
+ * so reading them gives the sum for the whole run, exited processes included.
+ * Direct child waits on sync pipe before exec, pooled child waits for instructions anyway.
+ * Hardware counters are often missing in VMs, software ones are counted then.
+ */
+
+struct perf_event_t {
+    __u32 type;
+    __u64 config;
+};
+
+static const perf_event_t perf_events[PERF_COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+static bool hardware_missing = false; /**< warned already, don't try again for every run */
+
+void perf_init(perf_t *perf) {
+    for (int i = 0; i < PERF_COUNTERS; ++i)
+        perf->fds[i] = -1;
+    perf->sync[0] = perf->sync[1] = -1;
+}
+
+/** Creates sync pipe, called before clone. @return -1 on error */
+int perf_prepare(perf_t *perf) {
+    if (pipe2(perf->sync, O_CLOEXEC) == -1) {
+        SYSERROR("can't create pipe for perf counters");
+        return -1;
+    }
+    return 0;
+}
+
+int open_counter(const perf_event_t *event, pid_t pid) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event->type;
+    attr.config = event->config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // kernel part varies with page cache, interrupts and so on, only the program's own work is counted
+    attr.exclude_kernel = event->type == PERF_TYPE_HARDWARE;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* Opens counters on child which hasn't exec'ed yet, missing counters are left -1 */
+void perf_open(perf_t *perf, pid_t pid, long instructions_limit) {
+    for (int i = 0; i < PERF_COUNTERS; ++i) {
+        if (perf_events[i].type == PERF_TYPE_HARDWARE && hardware_missing)
+            continue;
+        perf->fds[i] = open_counter(&perf_events[i], pid);
+        if (perf->fds[i] != -1)
+            continue;
+
+        if (perf_events[i].type == PERF_TYPE_HARDWARE && (errno == ENOENT || errno == EOPNOTSUPP || errno == ENODEV)) {
+            WARN("Hardware perf counters are not available, only software ones are counted");
+            hardware_missing = true;
+        } else {
+            SYSWARN("can't open perf counter %d", i);
+        }
+    }
+
+    if (instructions_limit > 0 && perf->fds[PERF_INSTRUCTIONS] == -1)
+        WARN("Instructions are not counted, only time limit is enforced");
+}
+
+void close_sync(perf_t *perf) {
+    if (perf->sync[0] != -1) close(perf->sync[0]);
+    if (perf->sync[1] != -1) close(perf->sync[1]);
+    perf->sync[0] = perf->sync[1] = -1;
+}
+
+/* Lets child exec, it goes on without counters if they can't be opened */
+void perf_start(perf_t *perf) {
+    if (perf->sync[1] != -1 && write(perf->sync[1], "", 1) != 1)
+        SYSWARN("can't let child exec");
+    close_sync(perf);
+}
+
+/* Called in child before exec */
+void perf_wait(perf_t *perf) {
+    if (perf->sync[0] == -1)
+        return;
+    close(perf->sync[1]);
+    char ack;
+    if (read(perf->sync[0], &ack, 1) != 1)
+        abort(); //parent is gone
+    close(perf->sync[0]);
+}
+
+/* Counters multiplexed with other users of PMU are scaled to the whole time they were enabled */
+void perf_read(const perf_t *perf, long long *values) {
+    for (int i = 0; i < PERF_COUNTERS; ++i) {
+        __u64 data[3]; //value, time enabled, time running
+        values[i] = -1;
+        if (perf->fds[i] == -1 || read(perf->fds[i], data, sizeof(data)) != sizeof(data))
+            continue;
+        if (data[2] && data[2] < data[1])
+            data[0] = (__u64) ((double) data[0] * data[1] / data[2]);
+        values[i] = data[0];
+    }
+}
+
+void perf_close(perf_t *perf) {
+    for (int i = 0; i < PERF_COUNTERS; ++i) {
+        if (perf->fds[i] != -1)
+            close(perf->fds[i]);
+        perf->fds[i] = -1;
+    }
+    close_sync(perf);
+}
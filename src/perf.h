@@ -0,0 +1,30 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef PERF_H_
+#define PERF_H_
+
+#include "process.h"
+
+void perf_init(perf_t *perf);
+int perf_prepare(perf_t *perf);
+void perf_open(perf_t *perf, pid_t pid, long instructions_limit);
+void perf_start(perf_t *perf);
+void perf_wait(perf_t *perf);
+void perf_read(const perf_t *perf, long long *values);
+void perf_close(perf_t *perf);
+
+#endif /* PERF_H_ */
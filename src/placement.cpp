@@ -0,0 +1,186 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "placement.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+/*
+ * Placement of runs on cores, so time of a run doesn't depend on where kernel has migrated it.
+ * Every cpu srun2 is allowed to run on is a slot, with idle_siblings only the first cpu
+ * of every physical core is, others are left idle, they share caches and execution units.
+ * A run takes a free slot, its child is pinned there and its memory is bound to the node
+ * of the cpu. Runs which don't get a slot wait in the queue of --serve.
+ */
+
+#define PLACEMENT_READ_BUF_SIZE 1024
+
+struct slot_t {
+    int cpu;
+    int node;
+    bool busy;
+};
+
+static slot_t *slots = NULL;
+static int slot_count = 0;
+static int free_count = 0;
+
+/* Parses lists like "0-3,8,10-11" of sysfs into set. @return -1 if file can't be read */
+int read_cpu_list(const char *path, cpu_set_t *set) {
+    CPU_ZERO(set);
+    FILE *f = fopen(path, "re");
+    if (!f)
+        return -1;
+
+    char buf[PLACEMENT_READ_BUF_SIZE];
+    bool ok = fgets(buf, sizeof(buf), f) != NULL;
+    fclose(f);
+    if (!ok)
+        return -1;
+
+    for (char *item = strtok(buf, ",\n"); item; item = strtok(NULL, ",\n")) {
+        int first, last;
+        int n = sscanf(item, "%d-%d", &first, &last);
+        if (n < 1)
+            continue;
+        if (n == 1)
+            last = first;
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, set);
+    }
+    return 0;
+}
+
+/* Without NUMA support in kernel everything is node 0 */
+int get_cpu_node(int cpu) {
+    char path[64];
+    cpu_set_t set;
+    for (int node = 0; ; ++node) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (read_cpu_list(path, &set) == -1)
+            return 0;
+        if (CPU_ISSET(cpu, &set))
+            return node;
+    }
+}
+
+/** Finds slots among cpus srun2 is allowed to run on. @return -1 on error */
+int placement_init(bool idle_siblings) {
+    cpu_set_t allowed, taken;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        SYSERROR("can't get cpus allowed for srun2");
+        return -1;
+    }
+
+    slots = (slot_t *) malloc(CPU_COUNT(&allowed) * sizeof(slot_t));
+    CPU_ZERO(&taken);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed) || CPU_ISSET(cpu, &taken))
+            continue;
+
+        if (idle_siblings) {
+            char path[96];
+            cpu_set_t siblings;
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+            if (read_cpu_list(path, &siblings) == 0)
+                CPU_OR(&taken, &taken, &siblings);
+        }
+
+        slots[slot_count].cpu = cpu;
+        slots[slot_count].node = get_cpu_node(cpu);
+        slots[slot_count].busy = false;
+        TRACE("placement slot %d: cpu %d, node %d", slot_count, cpu, slots[slot_count].node);
+        ++slot_count;
+    }
+    free_count = slot_count;
+
+    DEBUG("runs are placed on %d cores", slot_count);
+    return 0;
+}
+
+bool placement_enabled() {
+    return slots != NULL;
+}
+
+int placement_slots() {
+    return slot_count;
+}
+
+/** @return true if a run can be started now without sharing a core */
+bool placement_available() {
+    return !placement_enabled() || free_count > 0;
+}
+
+/* Takes a free slot, run is not pinned if placement is disabled or all slots are busy */
+void placement_acquire(placement_t *placement) {
+    placement->cpu = -1;
+    placement->node = -1;
+    placement->slot = -1;
+    if (!placement_enabled())
+        return;
+
+    for (int i = 0; i < slot_count; ++i) {
+        if (!slots[i].busy) {
+            slots[i].busy = true;
+            --free_count;
+            placement->cpu = slots[i].cpu;
+            placement->node = slots[i].node;
+            placement->slot = i;
+            return;
+        }
+    }
+    WARN("No free core, run is not pinned");
+}
+
+void placement_release(placement_t *placement) {
+    if (placement->slot == -1)
+        return;
+    slots[placement->slot].busy = false;
+    ++free_count;
+    placement->slot = -1;
+}
+
+/* Called in child, before seccomp is set up */
+void placement_enter(const placement_t *placement) {
+    if (placement->cpu == -1)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(placement->cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+        SYSWARN("can't pin process to cpu %d", placement->cpu);
+
+    // not critical, memory just may be remote; kernel ignores the last bit of maxnode
+    unsigned long nodemask;
+    const int maxnode = 8 * sizeof(nodemask);
+    if (placement->node >= maxnode)
+        return;
+    nodemask = 1UL << placement->node;
+    if (syscall(SYS_set_mempolicy, MPOL_BIND, &nodemask, maxnode + 1) == -1)
+        SYSWARN("can't bind memory to node %d", placement->node);
+}
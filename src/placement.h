@@ -0,0 +1,31 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef PLACEMENT_H_
+#define PLACEMENT_H_
+
+#include "process.h"
+
+int placement_init(bool idle_siblings);
+bool placement_enabled();
+int placement_slots();
+bool placement_available();
+void placement_acquire(placement_t *placement);
+void placement_release(placement_t *placement);
+void placement_enter(const placement_t *placement);
+
+#endif /* PLACEMENT_H_ */
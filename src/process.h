@@ -18,20 +18,102 @@
 #define OPTIONS_H_
 
 #include <unistd.h>
+#include <time.h>
+
+struct sock_fprog;
+struct syscall_profile_t;
 
 struct limits_t {
     long mem;       /**< Kbytes */
     long time;      /**< milliseconds */
     long real_time; /**< milliseconds */
+    long idle;      /**< milliseconds without cpu progress, 0 if not limited */
+    long output;    /**< Kbytes written to captured stdout and stderr, 0 if not limited */
+    long disk;      /**< Kbytes written to writable area of --jail-ns, 0 if not limited */
+    long instructions; /**< millions of instructions retired in user mode, 0 if not limited */
+};
+
+/*
+ * Limits enforced by kernel with setrlimit() in child, -1 keeps the limit srun2 was started with,
+ * -2 (PARSER_UNLIMITED) is RLIM_INFINITY. RLIMIT_CPU is set from limits_t.time.
+ */
+struct rlimits_t {
+    int as;       /**< Kbytes, address space, allocations beyond it fail with ENOMEM */
+    int stack;    /**< Kbytes */
+    int files;    /**< max number of open fds */
+    int filesize; /**< Kbytes, SIGXFSZ when written beyond */
+    int procs;    /**< processes of the real user, all of them are counted, not only the run's */
+    int core;     /**< Kbytes, core dumps */
 };
 
 struct jail_t {
     char *chroot;
     char *chdir;
-    // TODO
-    //int max_files; //see rlimit
-    //int max_stack;
-    //int max_filesize; + rlimit CPU + rlimit AS
+    bool mount_ns;  /**< chroot is entered with pivot_root in own mount namespace, see mount_jail.cpp */
+    bool overlay;   /**< root is writable overlay of chroot, writes go to tmpfs of the run */
+    long scratch;   /**< Kbytes, size of writable tmpfs in mount_ns jail, 0 if there is none (kernel's default for overlay) */
+    rlimits_t rlimits;
+};
+
+/* cgroup v2 leaf of one run, used as accounting and enforcement backend */
+struct cgroup_t {
+    char *path;     /**< leaf directory, NULL if cgroups are not used */
+    int procs_fd;   /**< cgroup.procs, child moves itself there before exec */
+    int stat_fd;    /**< cpu.stat */
+    int peak_fd;    /**< memory.peak (or memory.current on older kernels) */
+    int events_fd;  /**< memory.events */
+    int notify_fd;  /**< inotify watching memory.events, can be polled */
+    int pids_fd;    /**< pids.peak (or pids.current on older kernels), -1 without pids controller */
+    int kill_fd;    /**< cgroup.kill, -1 before Linux 5.14 */
+};
+
+/* Network, ipc and uts namespaces held by fds, so they can be reused by runs one after another */
+struct namespaces_t {
+    int net_fd;  /**< -1 if run creates its own namespaces */
+    int ipc_fd;
+    int uts_fd;
+    pid_t pid_init; /**< init of run's own pid namespace, -1 if there is none */
+};
+
+/* Stream of the program drained by hypervisor instead of going to a file directly, see capture.cpp */
+struct capture_t {
+    int read_fd;  /**< parent's end of pipe, -1 if stream isn't captured */
+    int write_fd; /**< child's end, becomes its stdout or stderr, parent closes it after spawn */
+    int dest_fd;  /**< file of --redirect-*, stream of srun2 itself or /dev/null */
+    bool use_splice; /**< cleared when dest_fd doesn't support splice, e.g. tty */
+};
+
+/* Core the run is pinned to, see placement.cpp */
+struct placement_t {
+    int cpu;  /**< -1 if run is not pinned */
+    int node; /**< NUMA node of cpu, memory is bound to it */
+    int slot; /**< slot of placement.cpp held by the run, -1 when it's released, cpu is kept for report */
+};
+
+/* Events counted by perf_event for the whole run, see perf.cpp */
+enum perf_counter_t {
+    PERF_INSTRUCTIONS = 0, /**< retired in user mode, hardware */
+    PERF_CYCLES,           /**< in user mode, hardware */
+    PERF_TASK_CLOCK,       /**< nanoseconds on cpu, software */
+    PERF_CONTEXT_SWITCHES, /**< software */
+    PERF_PAGE_FAULTS,      /**< software */
+    PERF_COUNTERS
+};
+
+struct perf_t {
+    int fds[PERF_COUNTERS]; /**< -1 if counter isn't opened, e.g. no hardware PMU in VM */
+    int sync[2];            /**< pipe child waits on before exec until counters are opened, -1 if it doesn't */
+};
+
+/* Streaming comparison of captured stdout with the expected answer, see checker.cpp */
+struct checker_t {
+    const char *expected; /**< mmapped answer, NULL if output isn't checked */
+    size_t size;
+    size_t pos;           /**< how much of expected is matched */
+    long long offset;     /**< bytes of output seen */
+    long long mismatch;   /**< offset in output of the first difference, -1 if none yet */
+    bool in_token;        /**< last byte of output was a part of token */
+    bool exact;           /**< compare bytes, not whitespace-separated tokens */
 };
 
 enum result_t {
@@ -40,17 +122,33 @@ enum result_t {
     _TL = 2, /**< Time limit exceeded */
     _ML = 3, /**< Memory limit exceeded */
     _SV = 4, /**< Security Violation */
-    _SC = 5  /**< System crash */
+    _SC = 5, /**< System crash */
+    _OL = 6, /**< Output limit exceeded */
+    _IL = 7, /**< Idleness limit exceeded */
+    _WA = 8, /**< Wrong answer, output differs from --expect */
+    _DL = 9  /**< Disk limit exceeded, writable area of jail is full */
 };
 
-const char* const result_to_str[] = {"OK", "RE", "TL", "ML", "SV", "SC"};
+const char* const result_to_str[] = {"OK", "RE", "TL", "ML", "SV", "SC", "OL", "IL", "WA", "DL"};
 
 /* Run statistics */
 struct stats_t {
     long real_time;        /**< milliseconds */
     long time;             /**< milliseconds */
     long mem;              /**< Kbytes */
-    long long start_time; /**< milliseconds, since epoch */
+    long long start_time; /**< milliseconds, monotonic clock */
+    long vm_peak;         /**< Kbytes, peak address space seen when sampling, only with rlimits.as */
+    int tasks;            /**< peak number of tasks (threads of all processes) of the run */
+    long long kill_time;  /**< milliseconds, monotonic clock, when the run was killed, -1 if it wasn't */
+    long kill_latency;    /**< milliseconds from kill to all processes gone, -1 if the run wasn't killed */
+    long long progress_time; /**< milliseconds, monotonic clock, when cpu time was seen growing last time */
+    long progress_cpu;       /**< milliseconds, cpu time seen then */
+    long long output;             /**< bytes written to captured stdout and stderr */
+    unsigned long long output_hash; /**< FNV-1a of captured stdout, only with output_hash */
+    long long mismatch;           /**< offset of the first byte of stdout that differs from --expect, -1 if none */
+    long wait_time;       /**< milliseconds main process slept, e.g. blocked on reads, -1 if unknown */
+    long long disk;       /**< bytes, peak usage of writable area of jail seen when sampling, -1 if it has none */
+    long long perf[PERF_COUNTERS]; /**< values of perf_counter_t for all processes of the run, -1 if not counted */
 
     int status; /**< status code, returned by waitpid function, @see man 2 waitpid for details */
 
@@ -61,16 +159,38 @@ struct process_t {
     limits_t limits;
     jail_t jail;
     stats_t stats;
+    char *image;      /**< name of image which jail is made of, see images.cpp, NULL if jail is given by options */
 
     char *redirect_stdin;
     char *redirect_stdout;
     char *redirect_stderr;
+    int stdin_fd;     /**< cached --redirect-stdin or pipe from --interactor, -1 if child opens it by itself */
+    int stdout_fd;    /**< pipe to --interactor, -1 if not interactive */
+    bool capture;     /**< stdout and stderr go through pipes drained by hypervisor */
+    bool output_hash; /**< hash captured stdout, data is copied through userspace then */
+    capture_t out, err;
+    char *expect;     /**< file with expected stdout, NULL if output isn't checked */
+    bool expect_exact; /**< stdout must be the same byte by byte, not only token by token */
+    bool expect_stop; /**< kill the run at the first mismatch */
+    checker_t checker;
 
     bool use_seccomp;
+    char *seccomp_profile; /**< name or path of seccomp profile, NULL for built-in default */
+    const struct sock_fprog *seccomp_filter; /**< compiled profile, set by spawn_process */
+    syscall_profile_t *syscall_profile; /**< --syscall-profile, NULL if syscalls are not profiled */
     bool use_namespaces;
 
+    char *cgroup_root; /**< existing cgroup v2 dir to create run's leaf in, NULL for /proc accounting */
+    cgroup_t cgroup;
+    namespaces_t ns; /**< used only with use_namespaces, pid namespace is always run's own */
+    placement_t placement;
+    int scratch_fd;  /**< tmpfs of jail, created by parent and moved into jail by child, -1 if none */
+    bool use_perf;   /**< count perf events of the run */
+    perf_t perf;
+
     char **argv;
     pid_t pid;
+    clockid_t cpu_clock; /**< child's process cpu-time clock, -1 if not available */
 };
 
 #endif /* OPTIONS_H_ */
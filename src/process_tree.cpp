@@ -0,0 +1,202 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "process_tree.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+
+#define TREE_PATH_MAX_LEN 64
+#define TREE_READ_BUF_SIZE 1024
+#define TREE_MAX_DEPTH 64
+#define TREE_KILL_MAX_PASSES 16
+
+/*
+ * Walks the tree through /proc/<pid>/task/<tid>/children, children of every thread are there.
+ * Each process is read with one read() of /proc/<pid>/stat, which is consistent.
+ *
+ * Processes exit and fork while we walk, missing ones are skipped: time of a process
+ * which has exited is in cutime/cstime of its parent after wait, and sampling catches up
+ * on the next period. Orphans leave the tree, with namespaces they are walked from init.
+ *
+ * Memory is proportional set size from /proc/<pid>/smaps_rollup (Linux 4.14+), pages shared by
+ * processes, e.g. copy-on-write ones of forked workers, are split between them instead of
+ * being counted by every one. Without smaps_rollup it's resident size from stat.
+ */
+
+void tree_usage_init(tree_usage_t *usage) {
+    usage->time = 0;
+    usage->mem = 0;
+    usage->tasks = 0;
+}
+
+int read_proc_file(const char *path, char *buf, size_t buf_len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    ssize_t len = read(fd, buf, buf_len - 1);
+    close(fd);
+    if (len < 0)
+        return -1;
+    buf[len] = '\0';
+    return 0;
+}
+
+/** @return Kbytes, proportional set size of process, -1 if it isn't known */
+long get_pss(pid_t pid) {
+    char path[TREE_PATH_MAX_LEN], buf[TREE_READ_BUF_SIZE];
+    snprintf(path, TREE_PATH_MAX_LEN, "/proc/%d/smaps_rollup", pid);
+    if (read_proc_file(path, buf, TREE_READ_BUF_SIZE))
+        return -1;
+
+    long pss;
+    char *pos = strstr(buf, "\nPss:");
+    if (!pos || sscanf(pos, "%*s %ld", &pss) != 1)
+        return -1;
+    return pss;
+}
+
+/* Adds one process, own usage only if count_self, usage of waited children always */
+void add_process_usage(pid_t pid, bool count_self, tree_usage_t *usage) {
+    char path[TREE_PATH_MAX_LEN], buf[TREE_READ_BUF_SIZE];
+    snprintf(path, TREE_PATH_MAX_LEN, "/proc/%d/stat", pid);
+    if (read_proc_file(path, buf, TREE_READ_BUF_SIZE))
+        return;
+
+    // comm may contain spaces and parentheses, fields are after the last ')'
+    char *fields = strrchr(buf, ')');
+    if (!fields)
+        return;
+
+    unsigned long utime, stime;
+    long cutime, cstime, threads, rss;
+    if (sscanf(fields + 2,
+        "%*c %*d %*d %*d %*d %*d %*u "  //state, ppid, pgrp, session, tty_nr, tpgid, flags
+        "%*u %*u %*u %*u "              //minflt, cminflt, majflt, cmajflt
+        "%lu %lu %ld %ld "              //utime, stime, cutime, cstime
+        "%*d %*d %ld %*d %*u %*u %ld",  //priority, nice, num_threads, itrealvalue, starttime, vsize, rss
+        &utime, &stime, &cutime, &cstime, &threads, &rss) != 6)
+        return;
+
+    static long ticks = sysconf(_SC_CLK_TCK);
+    static long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+    long long clock_ticks = cutime + cstime;
+    if (count_self) {
+        clock_ticks += utime + stime;
+        long pss = get_pss(pid);
+        usage->mem += pss != -1 ? pss : rss * page_kb;
+        usage->tasks += threads;
+    }
+    usage->time += clock_ticks * 1000 / ticks;
+}
+
+typedef void (*visitor_t)(pid_t pid, void *data);
+
+/* Calls visit for every descendant of pid, parents before children */
+void walk_descendants(pid_t pid, visitor_t visit, void *data, int depth) {
+    if (depth == TREE_MAX_DEPTH) {
+        WARN("Process tree is deeper than %d, deeper processes are not seen", TREE_MAX_DEPTH);
+        return;
+    }
+
+    char path[TREE_PATH_MAX_LEN];
+    snprintf(path, TREE_PATH_MAX_LEN, "/proc/%d/task", pid);
+    DIR *tasks = opendir(path);
+    if (!tasks)
+        return;
+
+    struct dirent *task;
+    while ((task = readdir(tasks))) {
+        pid_t tid = atoi(task->d_name);
+        if (tid <= 0) // "." and ".."
+            continue;
+
+        char buf[TREE_READ_BUF_SIZE];
+        snprintf(path, TREE_PATH_MAX_LEN, "/proc/%d/task/%d/children", pid, tid);
+        if (read_proc_file(path, buf, TREE_READ_BUF_SIZE))
+            continue;
+
+        // list may be cut at buffer size, rest of children are not seen in this walk
+        char *pos = buf, *end;
+        long child;
+        while ((child = strtol(pos, &end, 10)) > 0 && end != pos) {
+            visit(child, data);
+            walk_descendants(child, visit, data, depth + 1);
+            pos = end;
+        }
+    }
+    closedir(tasks);
+}
+
+void visit_usage(pid_t pid, void *usage) {
+    add_process_usage(pid, true, (tree_usage_t *) usage);
+}
+
+/** Adds usage of root's descendants and root's own usage if count_root */
+void add_tree_usage(pid_t root, bool count_root, tree_usage_t *usage) {
+    add_process_usage(root, count_root, usage);
+    walk_descendants(root, visit_usage, usage, 0);
+}
+
+struct stopped_t {
+    pid_t *pids;
+    int count, size;
+    bool found_new;
+};
+
+void visit_stop(pid_t pid, void *data) {
+    stopped_t *stopped = (stopped_t *) data;
+    for (int i = 0; i < stopped->count; ++i)
+        if (stopped->pids[i] == pid)
+            return;
+
+    if (stopped->count == stopped->size) {
+        stopped->size = stopped->size * 2 + 16;
+        stopped->pids = (pid_t *) realloc(stopped->pids, stopped->size * sizeof(pid_t));
+    }
+    stopped->pids[stopped->count++] = pid;
+    stopped->found_new = true;
+    kill(pid, SIGSTOP);
+}
+
+/*
+ * Kills root and all its descendants. Without pid namespace or cgroup nothing holds the tree
+ * together, and a killed parent leaves its children to the system init. So the tree is stopped
+ * first, walking it again until no new process appears (stopped ones can't fork), then killed.
+ * Processes orphaned before are out of reach.
+ */
+void kill_tree(pid_t root) {
+    stopped_t stopped = { NULL, 0, 0, false };
+    kill(root, SIGSTOP);
+
+    int passes = 0;
+    do {
+        stopped.found_new = false;
+        walk_descendants(root, visit_stop, &stopped, 0);
+    } while (stopped.found_new && ++passes < TREE_KILL_MAX_PASSES);
+
+    kill(root, SIGKILL);
+    for (int i = 0; i < stopped.count; ++i)
+        kill(stopped.pids[i], SIGKILL);
+    free(stopped.pids);
+}
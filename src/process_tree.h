@@ -0,0 +1,33 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef PROCESS_TREE_H_
+#define PROCESS_TREE_H_
+
+#include <sys/types.h>
+
+/* Usage summed over a process and all its descendants alive at the moment */
+struct tree_usage_t {
+    long time;  /**< milliseconds, user+system including children that were waited for */
+    long mem;   /**< Kbytes, proportional set size (resident if it isn't known) */
+    int tasks;  /**< threads of all processes */
+};
+
+void tree_usage_init(tree_usage_t *usage);
+void add_tree_usage(pid_t root, bool count_root, tree_usage_t *usage);
+void kill_tree(pid_t root);
+
+#endif /* PROCESS_TREE_H_ */
@@ -0,0 +1,382 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "server.h"
+#include "spawn.h"
+#include "supervisor.h"
+#include "placement.h"
+#include "caller.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+/*
+ * Protocol.
+ *
+ * Socket is SOCK_SEQPACKET, so every message is one frame and is read or written atomically.
+ *
+ * Request:  uint32 id, then NUL-terminated strings of srun2 command line without program name,
+ *           e.g. "-t\01000\0--redirect-stdin\0input.txt\0--\0./a.out\0".
+ *           Options given to the daemon itself are defaults for every request.
+ * Response: uint32 id, then report exactly as srun2 prints it (not NUL-terminated),
+ *           or "SRUN_ERROR\n" if request is invalid or can't be run.
+ *
+ * Ids are chosen by client and only echoed back, responses come in order of completion.
+ * All runs are hypervised by one supervisor inside the daemon, so many requests can be
+ * in flight at once without a process or a timer per request.
+ * With --pool, requests are started in children cloned and jailed in advance.
+ * With --placement, requests also wait for a free core.
+ */
+
+#define SERVER_MAX_MESSAGE (64*1024)
+#define SERVER_BACKLOG 64
+#define SERVER_MAX_EVENTS 64
+
+typedef uint32_t request_id_t;
+
+/* Client connection, fd is closed only when no request refers to it, so it can't be reused */
+struct client_t {
+    int fd;
+    int refs;
+    bool closed;
+};
+
+struct request_t {
+    client_t *client;
+    request_id_t id;
+    process_t *proc;
+    request_t *next;
+};
+
+static const server_handlers_t *handlers;
+static supervisor_t *supervisor;
+static request_t *queue_head = NULL, *queue_tail = NULL;
+static int epoll_fd = -1;
+static client_t **clients = NULL; /**< indexed by fd */
+static int clients_size = 0;
+
+/*
+ * Stale socket of previous daemon is removed, but only a socket of the caller: we are setuid root
+ * and the path is given by the caller. Called with permissions of the caller. @return false on error,
+ * EEXIST if path is taken by something else
+ */
+bool remove_stale_socket(const char *socket_path) {
+    struct stat st;
+    if (lstat(socket_path, &st) == -1)
+        return errno == ENOENT;
+    if (!S_ISSOCK(st.st_mode) || st.st_uid != getuid()) {
+        errno = EEXIST;
+        return false;
+    }
+    return unlink(socket_path) == 0;
+}
+
+/* Socket is created with permissions of the real caller and is usable only by it (and root) */
+int create_server_socket(const char *socket_path) {
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        ERROR("Socket path is too long: %s", socket_path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        SYSERROR("can't create socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    uid_t euid;
+    if (!drop_euid(&euid)) {
+        SYSERROR("can't switch to uid of the caller");
+        close(fd);
+        return -1;
+    }
+    bool bound = remove_stale_socket(socket_path) && bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+    if (bound && chmod(socket_path, 0600) == -1)
+        SYSWARN("can't set mode of socket %s", socket_path);
+    restore_euid(euid);
+    if (!bound) {
+        SYSERROR("can't bind socket to %s", socket_path);
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, SERVER_BACKLOG) == -1) {
+        SYSERROR("can't listen on socket");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Only the real caller of setuid srun2 and root are allowed to make requests */
+bool check_peer(int fd) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+        SYSWARN("can't get credentials of client");
+        return false;
+    }
+    return cred.uid == 0 || cred.uid == getuid();
+}
+
+bool add_to_epoll(int epfd, int fd) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+void add_client(int fd) {
+    if (fd >= clients_size) {
+        int new_size = fd * 2 + 1;
+        clients = (client_t **) realloc(clients, new_size * sizeof(client_t *));
+        memset(clients + clients_size, 0, (new_size - clients_size) * sizeof(client_t *));
+        clients_size = new_size;
+    }
+
+    client_t *client = (client_t *) malloc(sizeof(client_t));
+    client->fd = fd;
+    client->refs = 1; //connection itself
+    client->closed = false;
+    clients[fd] = client;
+}
+
+void unref_client(client_t *client) {
+    if (--client->refs)
+        return;
+    clients[client->fd] = NULL;
+    close(client->fd);
+    free(client);
+}
+
+void close_client(client_t *client) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    client->closed = true;
+    unref_client(client);
+}
+
+void send_response(client_t *client, request_id_t id, const char *report, size_t len) {
+    if (client->closed)
+        return;
+
+    char msg[SERVER_MAX_MESSAGE];
+    if (len > SERVER_MAX_MESSAGE - sizeof(id))
+        len = SERVER_MAX_MESSAGE - sizeof(id);
+
+    memcpy(msg, &id, sizeof(id));
+    memcpy(msg + sizeof(id), report, len);
+    if (send(client->fd, msg, sizeof(id) + len, MSG_NOSIGNAL | MSG_DONTWAIT) == -1)
+        SYSWARN("can't send response for request %u", id);
+}
+
+void send_error(client_t *client, request_id_t id) {
+    send_response(client, id, "SRUN_ERROR\n", strlen("SRUN_ERROR\n"));
+}
+
+void free_request(request_t *req) {
+    if (req->proc)
+        handlers->destroy(req->proc);
+    unref_client(req->client);
+    free(req);
+}
+
+/* Splits request into argv, @return argc or -1 if request is malformed */
+int split_request(char *data, size_t len, char ***argv) {
+    if (len == 0 || data[len - 1] != '\0')
+        return -1;
+
+    int argc = 1;
+    for (size_t i = 0; i < len; ++i)
+        if (data[i] == '\0')
+            ++argc;
+
+    *argv = (char **) malloc((argc + 1) * sizeof(char *));
+    (*argv)[0] = (char *) "srun2";
+    char *cur = data;
+    for (int i = 1; i < argc; ++i) {
+        (*argv)[i] = cur;
+        cur += strlen(cur) + 1;
+    }
+    (*argv)[argc] = NULL;
+    return argc;
+}
+
+void run_finished(process_t *proc, void *data) {
+    request_t *req = (request_t *) data;
+    release_process(proc);
+
+    char *report = NULL;
+    size_t report_len = 0;
+    FILE *stream = open_memstream(&report, &report_len);
+    handlers->report(stream, proc);
+    fclose(stream);
+
+    send_response(req->client, req->id, report, report_len);
+    free(report);
+    free_request(req);
+}
+
+void start_request(request_t *req) {
+    if (spawn_process(req->proc) == -1) {
+        send_error(req->client, req->id);
+        free_request(req);
+        return;
+    }
+
+    if (supervisor_add(supervisor, req->proc, run_finished, req) == -1) {
+        release_process(req->proc);
+        send_error(req->client, req->id);
+        free_request(req);
+    }
+}
+
+void start_pending_requests(int max_runs) {
+    while (queue_head && supervisor_count(supervisor) < max_runs && placement_available()) {
+        request_t *req = queue_head;
+        queue_head = req->next;
+        if (!queue_head)
+            queue_tail = NULL;
+
+        if (req->client->closed)
+            free_request(req);
+        else
+            start_request(req);
+    }
+}
+
+void handle_client(client_t *client) {
+    char data[SERVER_MAX_MESSAGE];
+    ssize_t len = recv(client->fd, data, SERVER_MAX_MESSAGE, MSG_TRUNC | MSG_DONTWAIT);
+
+    if (len == -1) {
+        if (errno != EAGAIN && errno != EINTR)
+            close_client(client);
+        return;
+    }
+
+    if (len == 0) { //client closed connection
+        close_client(client);
+        return;
+    }
+
+    if ((size_t) len < sizeof(request_id_t) || len > SERVER_MAX_MESSAGE) {
+        WARN("Malformed or too long request of %zd bytes, ignored", len);
+        return;
+    }
+
+    request_t *req = (request_t *) malloc(sizeof(request_t));
+    memcpy(&req->id, data, sizeof(req->id));
+    req->client = client;
+    req->next = NULL;
+    req->proc = NULL;
+    ++client->refs;
+
+    char **argv;
+    int argc = split_request(data + sizeof(req->id), len - sizeof(req->id), &argv);
+    if (argc == -1) {
+        ERROR("Malformed request %u", req->id);
+    } else {
+        req->proc = handlers->create(argc, argv);
+        free(argv);
+    }
+
+    if (!req->proc) {
+        send_error(client, req->id);
+        free_request(req);
+        return;
+    }
+
+    if (queue_tail)
+        queue_tail->next = req;
+    else
+        queue_head = req;
+    queue_tail = req;
+}
+
+/** Serves requests forever. @return -1 on error */
+int serve(const char *socket_path, int max_runs, const server_handlers_t *server_handlers) {
+    handlers = server_handlers;
+
+    int listen_fd = create_server_socket(socket_path);
+    if (listen_fd == -1)
+        return -1;
+
+    supervisor = supervisor_create();
+    if (!supervisor)
+        return -1;
+    int supervisor_epfd = supervisor_fd(supervisor);
+
+    int epfd = epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1 || !add_to_epoll(epfd, listen_fd) || !add_to_epoll(epfd, supervisor_epfd)) {
+        SYSERROR("can't set up event loop");
+        return -1;
+    }
+
+    INFO("Serving requests on %s, max %d in flight", socket_path, max_runs);
+
+    while (1) {
+        // pool is refilled one child at a time, when there is nothing else to do
+        struct epoll_event events[SERVER_MAX_EVENTS];
+        int n = epoll_wait(epfd, events, SERVER_MAX_EVENTS, pool_full() ? -1 : 0);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            SYSERROR("epoll_wait failed");
+            return -1;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd) {
+                int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+                if (client_fd == -1) {
+                    SYSWARN("can't accept client");
+                } else if (!check_peer(client_fd)) {
+                    WARN("Client is not allowed to make requests");
+                    close(client_fd);
+                } else if (!add_to_epoll(epfd, client_fd)) {
+                    SYSWARN("can't add client to epoll");
+                    close(client_fd);
+                } else {
+                    add_client(client_fd);
+                }
+            } else if (fd == supervisor_epfd) {
+                supervisor_dispatch(supervisor);
+            } else if (fd < clients_size && clients[fd]) {
+                handle_client(clients[fd]);
+            }
+        }
+
+        start_pending_requests(max_runs);
+
+        if (n == 0 && !pool_full())
+            pool_refill_one();
+    }
+}
@@ -0,0 +1,39 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include "process.h"
+
+#include <stdio.h>
+
+struct server_handlers_t {
+    /**
+     * Parses request into a new process, ready to be spawned.
+     * @param argv command line of the request, argv[0] is a dummy program name, argv[argc] is NULL
+     * @return NULL if request is invalid
+     */
+    process_t *(*create)(int argc, char **argv);
+    /** Prints report of finished process, it is sent back to the client */
+    void (*report)(FILE *stream, process_t *proc);
+    /** Frees process made by create */
+    void (*destroy)(process_t *proc);
+};
+
+int serve(const char *socket_path, int max_runs, const server_handlers_t *handlers);
+
+#endif /* SERVER_H_ */
@@ -14,103 +14,298 @@
  *  limitations under the License.
  */
 
+#include "setup_seccomp.h"
+#include "caller.h"
 #include "log.h"
 
 #include <seccomp.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
 
 /*
- * Workes with this rule set:
- *  - simpe C++
- *  - Python 2.7
+ * Profile is a list of allowed syscalls, one rule per line, '#' starts a comment:
+ *   read
+ *   socket arg0 == 1
+ *   clone arg0 & 0x10000 == 0x10000
+ * Conditions of one line must all hold (operators ==, !=, <, <=, >, >= and "& mask =="),
+ * lines of the same syscall are alternatives. Any other syscall kills the process.
+ *
+ * Profile is compiled by libseccomp once, in parent, and exported as BPF program.
+ * Child installs it with one prctl(), so rules aren't rebuilt after every fork.
  */
 
-void setup_seccomp() {
-    int ret = -1;
-    scmp_filter_ctx ctx;
-
-    ctx = seccomp_init(SCMP_ACT_KILL);
-    if (ctx == NULL) goto err;
-
-//For less copypasting:
-#define ALLOW_SYSCALL(syscall) \
-    ret = seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(syscall), 0); \
-    if (ret < 0) goto err;
-// end of macros
-
-    // -- ALL RULES GO HERE --
+#define PROFILE_MAX_LINE 1024
+#define PROFILE_DELIMS " \t\r\n"
 
+/*
+ * Built-in profile, used when no other is given.
+ * Workes with:
+ *  - simpe C++
+ *  - Python 2.7
+ */
+static const char * const default_profile[] = {
     // File access and file descriptors
-    ALLOW_SYSCALL(access);
-    ALLOW_SYSCALL(open);
-    ALLOW_SYSCALL(read);
-    ALLOW_SYSCALL(readv);
-    ALLOW_SYSCALL(write);
-    ALLOW_SYSCALL(writev);
-    ALLOW_SYSCALL(preadv);
-    ALLOW_SYSCALL(pwritev);
-    ALLOW_SYSCALL(close);
-    ALLOW_SYSCALL(fstat);
-    ALLOW_SYSCALL(lstat);
-    ALLOW_SYSCALL(stat);
-    ALLOW_SYSCALL(ioctl);
-    ALLOW_SYSCALL(lseek);
-    ALLOW_SYSCALL(openat);
-    ALLOW_SYSCALL(readlink);
-    ALLOW_SYSCALL(getdents);
-    ALLOW_SYSCALL(getdents64);
-    ALLOW_SYSCALL(unlink);
-    ALLOW_SYSCALL(dup);
-    ALLOW_SYSCALL(dup2);
-    ALLOW_SYSCALL(dup3);
-    ALLOW_SYSCALL(fcntl);
+    "access", "open", "read", "readv", "write", "writev", "preadv", "pwritev", "close",
+    "fstat", "lstat", "stat", "ioctl", "lseek", "openat", "readlink", "getdents", "getdents64",
+    "unlink", "dup", "dup2", "dup3", "fcntl",
 
     // memory
-    ALLOW_SYSCALL(brk);
-    ALLOW_SYSCALL(mmap);
-    ALLOW_SYSCALL(mprotect);
-    ALLOW_SYSCALL(munmap);
+    "brk", "mmap", "mprotect", "munmap",
 
     // getting info
-    ALLOW_SYSCALL(getcwd);
-    ALLOW_SYSCALL(getegid);
-    ALLOW_SYSCALL(geteuid);
-    ALLOW_SYSCALL(getgid);
-    ALLOW_SYSCALL(getuid);
-    ALLOW_SYSCALL(getrlimit);
+    "getcwd", "getegid", "geteuid", "getgid", "getuid", "getrlimit",
 
     // futexes
-    ALLOW_SYSCALL(futex);
-    ALLOW_SYSCALL(set_robust_list);
+    "futex", "set_robust_list",
 
     //signals
-    ALLOW_SYSCALL(rt_sigaction);
-    ALLOW_SYSCALL(rt_sigprocmask);
-    ALLOW_SYSCALL(sigaltstack);
+    "rt_sigaction", "rt_sigprocmask", "sigaltstack",
 
     //sleep and times
-    ALLOW_SYSCALL(nanosleep);
+    "nanosleep",
 
     // other
-    ALLOW_SYSCALL(execve);
-    ALLOW_SYSCALL(exit_group);
-    ALLOW_SYSCALL(set_tid_address);
-    ALLOW_SYSCALL(arch_prctl);
-    ALLOW_SYSCALL(sysinfo);
-    ALLOW_SYSCALL(getrandom);
-    ALLOW_SYSCALL(getpid);
+    "execve", "exit_group", "set_tid_address", "arch_prctl", "sysinfo", "getrandom", "getpid",
+    NULL
+};
+
+/* Allows nothing, for --syscall-profile of everything the program does */
+static const char * const none_profile[] = { NULL };
+
+struct compare_op_t {
+    const char *str;
+    enum scmp_compare op;
+};
+
+static const compare_op_t compare_ops[] = {
+    { "==", SCMP_CMP_EQ }, { "!=", SCMP_CMP_NE },
+    { "<",  SCMP_CMP_LT }, { "<=", SCMP_CMP_LE },
+    { ">",  SCMP_CMP_GT }, { ">=", SCMP_CMP_GE },
+    { NULL }
+};
+
+/* Profiles are compiled once and kept for the lifetime of srun2 */
+struct compiled_profile_t {
+    char *name;
+    bool notify;
+    struct sock_fprog filter;
+    compiled_profile_t *next;
+};
+
+static compiled_profile_t *compiled = NULL;
+
+/* Profile being parsed, for error messages */
+struct profile_pos_t {
+    const char *name;
+    int line;
+};
+
+bool parse_datum(const char *str, scmp_datum_t *datum) {
+    if (!str)
+        return false;
+    char *end;
+    errno = 0;
+    *datum = strtoull(str, &end, 0);
+    return str[0] != '\0' && end[0] == '\0' && errno == 0;
+}
+
+/* Parses "argN op value" or "argN & mask == value", tokens come from strtok_r. @return false on error */
+bool parse_condition(const char *arg, char **saveptr, struct scmp_arg_cmp *cmp) {
+    if (strncmp(arg, "arg", 3) || arg[3] < '0' || arg[3] > '5' || arg[4] != '\0')
+        return false;
+    cmp->arg = arg[3] - '0';
+    cmp->datum_b = 0;
+
+    const char *op = strtok_r(NULL, PROFILE_DELIMS, saveptr);
+    if (op && !strcmp(op, "&")) {
+        cmp->op = SCMP_CMP_MASKED_EQ;
+        if (!parse_datum(strtok_r(NULL, PROFILE_DELIMS, saveptr), &cmp->datum_a))
+            return false;
+        op = strtok_r(NULL, PROFILE_DELIMS, saveptr);
+        return op && !strcmp(op, "==") && parse_datum(strtok_r(NULL, PROFILE_DELIMS, saveptr), &cmp->datum_b);
+    }
+
+    for (const compare_op_t *cur = compare_ops; op && cur->str; ++cur) {
+        if (!strcmp(op, cur->str)) {
+            cmp->op = cur->op;
+            return parse_datum(strtok_r(NULL, PROFILE_DELIMS, saveptr), &cmp->datum_a);
+        }
+    }
+    return false;
+}
+
+/* Adds rule of one profile line. @return syscall number, 0 for empty line, -1 on error */
+int add_rule(scmp_filter_ctx ctx, char *line, const profile_pos_t *pos) {
+    char *comment = strchr(line, '#');
+    if (comment)
+        *comment = '\0';
 
-    // -- end of rules part --
+    char *saveptr;
+    char *name = strtok_r(line, PROFILE_DELIMS, &saveptr);
+    if (!name)
+        return 0;
 
-    ret = seccomp_load(ctx);
+    int syscall_nr = seccomp_syscall_resolve_name(name);
+    if (syscall_nr == __NR_SCMP_ERROR) {
+        ERROR("Unknown syscall \"%s\" in seccomp profile %s:%d", name, pos->name, pos->line);
+        return -1;
+    }
+
+    struct scmp_arg_cmp args[6];
+    unsigned int arg_cnt = 0;
+    char *arg;
+    while ((arg = strtok_r(NULL, PROFILE_DELIMS, &saveptr))) {
+        if (arg_cnt == 6 || !parse_condition(arg, &saveptr, &args[arg_cnt])) {
+            ERROR("Bad condition for \"%s\" in seccomp profile %s:%d", name, pos->name, pos->line);
+            return -1;
+        }
+        ++arg_cnt;
+    }
+
+    if (seccomp_rule_add_array(ctx, SCMP_ACT_ALLOW, syscall_nr, arg_cnt, args) < 0) {
+        ERROR("Can't add rule for \"%s\" in seccomp profile %s:%d", name, pos->name, pos->line);
+        return -1;
+    }
+    return syscall_nr;
+}
+
+/* @return -1 on error, 0 if profile doesn't allow execve, 1 if it does */
+int add_profile_rules(scmp_filter_ctx ctx, const char *profile) {
+    profile_pos_t pos = { profile, 0 };
+    char line[PROFILE_MAX_LINE];
+    int allows_execve = 0;
+
+    const char * const *builtin = NULL;
+    if (!strcmp(profile, "default"))
+        builtin = default_profile;
+    else if (!strcmp(profile, "none"))
+        builtin = none_profile;
+
+    if (builtin) {
+        for (const char * const *rule = builtin; *rule; ++rule) {
+            strcpy(line, *rule);
+            if (add_rule(ctx, line, &pos) == -1)
+                return -1;
+        }
+        return builtin == default_profile;
+    }
+
+    char path[PATH_MAX];
+    if (strchr(profile, '/'))
+        snprintf(path, PATH_MAX, "%s", profile);
+    else
+        snprintf(path, PATH_MAX, "%s/%s", SECCOMP_PROFILE_DIR, profile);
+
+    FILE *f = fopen_as_caller(path, "re");
+    if (!f) {
+        SYSERROR("can't open seccomp profile %s", path);
+        return -1;
+    }
+
+    int ret = 0;
+    while (fgets(line, PROFILE_MAX_LINE, f)) {
+        ++pos.line;
+        int syscall_nr = add_rule(ctx, line, &pos);
+        if (syscall_nr == -1) {
+            ret = -1;
+            break;
+        }
+        if (syscall_nr == SCMP_SYS(execve))
+            allows_execve = 1;
+    }
+    fclose(f);
+    return ret == -1 ? -1 : allows_execve;
+}
+
+/* Reads BPF program exported by libseccomp. @return -1 on error */
+int export_filter(scmp_filter_ctx ctx, struct sock_fprog *filter) {
+    int fd = memfd_create("seccomp_bpf", MFD_CLOEXEC);
+    if (fd == -1) {
+        SYSERROR("can't create memfd for seccomp filter");
+        return -1;
+    }
+
+    struct stat st;
+    int ret = -1;
+    if (seccomp_export_bpf(ctx, fd) < 0 || fstat(fd, &st) == -1) {
+        ERROR("Can't export seccomp filter");
+    } else {
+        filter->len = st.st_size / sizeof(struct sock_filter);
+        filter->filter = (struct sock_filter *) malloc(st.st_size);
+        if (pread(fd, filter->filter, st.st_size, 0) == st.st_size)
+            ret = 0;
+        else
+            SYSERROR("can't read seccomp filter");
+    }
+    close(fd);
+    return ret;
+}
+
+/**
+ * Compiles profile (name in SECCOMP_PROFILE_DIR, path, or NULL for built-in default),
+ * returns already compiled filter if profile was used before. @return NULL on error
+ * With notify syscalls outside of profile are passed to listener instead of killing, see syscall_profile.cpp
+ */
+const struct sock_fprog *prepare_seccomp(const char *profile, bool notify) {
+    if (!profile)
+        profile = "default";
+
+    for (compiled_profile_t *cur = compiled; cur; cur = cur->next)
+        if (!strcmp(cur->name, profile) && cur->notify == notify)
+            return &cur->filter;
+
+    compiled_profile_t *result = (compiled_profile_t *) malloc(sizeof(compiled_profile_t));
+    result->filter.filter = NULL;
+    int ret = -1;
+    scmp_filter_ctx ctx;
+
+    // whole process, killed thread of a multithreaded runtime would leave the rest hanging until TL
+    ctx = seccomp_init(notify ? SCMP_ACT_NOTIFY : SCMP_ACT_KILL_PROCESS);
+    if (ctx == NULL) goto err;
+
+    // binary tree instead of linear chain of syscall numbers, libseccomp >= 2.5
+    if (seccomp_attr_set(ctx, SCMP_FLTATR_CTL_OPTIMIZE, 2) < 0) {
+        DEBUG("libseccomp can't optimize filter, linear one is used");
+    }
+
+    ret = add_profile_rules(ctx, profile);
+    if (ret < 0) goto err;
+    if (ret == 0 && !notify) {
+        ERROR("Seccomp profile %s doesn't allow execve, program can't be started", profile);
+        goto err;
+    }
+
+    ret = export_filter(ctx, &result->filter);
     if (ret < 0) goto err;
 
     seccomp_release(ctx);
-    return;
+    result->name = strdup(profile);
+    result->notify = notify;
+    result->next = compiled;
+    compiled = result;
+    DEBUG("seccomp profile %s is compiled, %d instructions", profile, result->filter.len);
+    return &result->filter;
 
 err:
-    ERROR("Error while installing seccomp_filter");
+    ERROR("Error while compiling seccomp_filter");
     seccomp_release(ctx);
-    abort();
+    free(result->filter.filter);
+    free(result);
+    return NULL;
 }
 
+/* Called in child after NO_NEW_PRIVS is set */
+void setup_seccomp(const struct sock_fprog *filter) {
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, filter) == -1) {
+        SYSERROR("Error while installing seccomp_filter");
+        abort();
+    }
+}
@@ -16,6 +16,14 @@
 #ifndef SETUP_SECCOMP_H_
 #define SETUP_SECCOMP_H_
 
-void setup_seccomp();
+/* Where profiles given by name are looked up */
+#ifndef SECCOMP_PROFILE_DIR
+#define SECCOMP_PROFILE_DIR "/etc/srun2/seccomp"
+#endif
+
+struct sock_fprog;
+
+const struct sock_fprog *prepare_seccomp(const char *profile, bool notify);
+void setup_seccomp(const struct sock_fprog *filter);
 
 #endif /* SETUP_SECCOMP_H_ */
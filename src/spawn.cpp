@@ -15,12 +15,26 @@
  */
 
 #include "log.h"
+#include "caller.h"
 #include "process.h"
 #include "setup_seccomp.h"
+#include "cgroup.h"
+#include "namespaces.h"
+#include "syscall_profile.h"
+#include "capture.h"
+#include "input_cache.h"
+#include "placement.h"
+#include "perf.h"
+#include "mount_jail.h"
+#include "hypervisor.h"
+#include "parser.h"
+#include "spawn.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 
 #include <sched.h>
 #include <signal.h>
@@ -30,7 +44,17 @@
 #include <grp.h>
 #include <sys/prctl.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
 #include <sys/capability.h>
+#include <linux/filter.h>
+#include <linux/openat2.h>
+
+#ifndef SYS_openat2
+#define SYS_openat2 437
+#endif
 
 
 /**
@@ -119,6 +143,36 @@ void redirect_to_file_or_null(int fd, int null_fd, char *filename, const char *m
 }
 
 
+/*
+ * Opens file of --redirect-* in parent as the child would after chroot and chdir, with permissions
+ * of the real caller. Inside of chroot path is resolved with RESOLVE_IN_ROOT, so symlinks can't lead out.
+ */
+int open_in_jail(const jail_t *jail, const char *filename, int flags) {
+    char path[PATH_MAX];
+    if (filename[0] != '/' && jail->chdir)
+        snprintf(path, PATH_MAX, "%s/%s", jail->chdir, filename);
+    else
+        snprintf(path, PATH_MAX, "%s", filename);
+
+    if (!jail->chroot)
+        return open_as_caller(path, flags);
+
+    uid_t euid;
+    if (!drop_euid(&euid))
+        return -1;
+    struct open_how how;
+    memset(&how, 0, sizeof(how));
+    how.flags = flags | O_CLOEXEC;
+    how.mode = (flags & O_CREAT) ? 0666 : 0;
+    how.resolve = RESOLVE_IN_ROOT;
+    int root_fd = open(jail->chroot, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    int fd = root_fd == -1 ? -1 : syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+    if (root_fd != -1)
+        close(root_fd);
+    restore_euid(euid);
+    return fd;
+}
+
 void drop_capabilities() {
     cap_t empty;
     empty = cap_init();
@@ -161,61 +215,617 @@ void setup_uidgid() {
     }
 }
 
+void set_rlimit(int resource, rlim_t soft, rlim_t hard, const char *name) {
+    struct rlimit rl;
+    rl.rlim_cur = soft;
+    rl.rlim_max = hard;
+    if (setrlimit(resource, &rl) == -1) {
+        SYSERROR("can't set %s", name);
+        abort();
+    }
+}
 
-int do_start(void *_data) {
-    process_t *proc = (process_t *) _data;
+/* Soft and hard limits are the same, value is multiplied by unit. -1 is not set, see rlimits_t */
+void set_jail_rlimit(int resource, int value, rlim_t unit, const char *name) {
+    if (value == -1)
+        return;
+    rlim_t limit = (value == PARSER_UNLIMITED) ? RLIM_INFINITY : value * unit;
+    set_rlimit(resource, limit, limit, name);
+}
+
+void setup_rlimits(const process_t *proc) {
+    /* Backstop for cpu time limit, in case hypervisor misses it.
+     * Precise limit is cpu timer in hypervisor, this one has 1 second granularity. */
+    rlim_t cpu_secs = (proc->limits.time + 999) / 1000 + 1;
+    set_rlimit(RLIMIT_CPU, cpu_secs, cpu_secs + 1, "RLIMIT_CPU");
+
+    const rlimits_t *rl = &proc->jail.rlimits;
+    set_jail_rlimit(RLIMIT_AS, rl->as, 1024, "RLIMIT_AS");
+    set_jail_rlimit(RLIMIT_STACK, rl->stack, 1024, "RLIMIT_STACK");
+    set_jail_rlimit(RLIMIT_NOFILE, rl->files, 1, "RLIMIT_NOFILE");
+    set_jail_rlimit(RLIMIT_FSIZE, rl->filesize, 1024, "RLIMIT_FSIZE");
+    set_jail_rlimit(RLIMIT_NPROC, rl->procs, 1, "RLIMIT_NPROC");
+    set_jail_rlimit(RLIMIT_CORE, rl->core, 1024, "RLIMIT_CORE");
+}
 
+
+/* Raising rlimits above the inherited hard limits needs CAP_SYS_RESOURCE, so this goes after setup_rlimits */
+void drop_privileges() {
+    setup_uidgid();
+    drop_capabilities();
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
+        SYSWARN("Can't set NO_NEW_PRIVS flag for the process");
+}
+
+/*
+ * First half of child setup, everything that doesn't depend on the program being run.
+ * Child is still privileged after it, see drop_privileges. @return fd of /dev/null
+ */
+int enter_jail(process_t *proc) {
     //Setup child after exec.
     prctl(PR_SET_PDEATHSIG, SIGKILL); //child MUST be killed when parent dies
+    cgroup_enter(&proc->cgroup);
+
+    //Parent may block signals for its signalfd, mask is inherited through exec
+    sigset_t empty_mask;
+    sigemptyset(&empty_mask);
+    sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+    //Ignored signals stay ignored after exec too, e.g. SIGXFSZ of RLIMIT_FSIZE when started from python
+    for (int sig = 1; sig < NSIG; ++sig)
+        signal(sig, SIG_DFL);
     setup_inherited_fds();
 
     //Open /dev/null
     int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
 
     //Go to jail
-    do_chroot(proc->jail.chroot);
+    if (proc->jail.mount_ns)
+        enter_mount_jail(&proc->jail, proc->scratch_fd);
+    else
+        do_chroot(proc->jail.chroot);
 
-    //Drop all privileges
-    setup_uidgid();
-    drop_capabilities();
-    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
-        SYSWARN("Can't set NO_NEW_PRIVS flag for the process");
+    return null_fd;
+}
 
-    //Set up limits
-    //TODO: setup rlimit
+/* Second half of child setup, for the program being run */
+int start_program(process_t *proc, int null_fd) {
+    //Set up limits while we still may raise them, then drop all privileges
+    setup_rlimits(proc);
+    drop_privileges();
+    placement_enter(&proc->placement);
 
     //Now we can do chdir and redirect fd's
     do_chdir(proc->jail.chdir);
-    redirect_to_file_or_null(STDIN_FILENO, null_fd, proc->redirect_stdin, "r");
-    redirect_to_file_or_null(STDOUT_FILENO, null_fd, proc->redirect_stdout, "w");
+    if (proc->stdin_fd != -1)
+        redirect_fd(STDIN_FILENO, proc->stdin_fd);
+    else
+        redirect_to_file_or_null(STDIN_FILENO, null_fd, proc->redirect_stdin, "r");
+    if (proc->stdout_fd != -1)
+        redirect_fd(STDOUT_FILENO, proc->stdout_fd);
+    else if (proc->capture)
+        capture_enter(proc);
+    else
+        redirect_to_file_or_null(STDOUT_FILENO, null_fd, proc->redirect_stdout, "w");
     // Redirecting stderr must be done after stdout to correctly handle case when redirecting stderr to stdout
     if (proc->redirect_stderr && !strcmp(proc->redirect_stderr, "stdout"))
         redirect_fd(STDERR_FILENO, STDOUT_FILENO);
-    else
+    else if (proc->err.write_fd == -1)
         redirect_to_file_or_null(STDERR_FILENO, null_fd, proc->redirect_stderr, "w");
 
-    if (proc->use_seccomp)
-        setup_seccomp();
+    perf_wait(&proc->perf);
+    if (proc->syscall_profile)
+        syscall_profile_install(proc->syscall_profile, proc->seccomp_filter);
+    else if (proc->use_seccomp)
+        setup_seccomp(proc->seccomp_filter);
 
     execvp(proc->argv[0], proc->argv);
     ERROR("Can`t exec %s: %s", proc->argv[0], strerror(errno));
     return 1;
 }
 
+int do_start(void *_data) {
+    process_t *proc = (process_t *) _data;
+    ns_enter(&proc->ns);
+    int null_fd = enter_jail(proc);
+    return start_program(proc, null_fd);
+}
 
-int spawn_process(process_t *proc) {
-    int clone_flags = 0;
+int get_clone_flags(const process_t *proc) {
+    if (proc->ns.net_fd != -1) // namespaces are entered with setns()
+        return 0;
     if (proc->use_namespaces)
-        clone_flags = CLONE_NEWUTS | CLONE_NEWPID | CLONE_NEWIPC | CLONE_NEWNET;
+        return CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWNET;
+    return 0;
+}
 
-    proc->pid = saferun_clone(do_start, proc, clone_flags);
+/* Clones child of proc, with namespaces it is pid 2 of new pid namespace, see namespaces.cpp */
+pid_t clone_jailed(int (*fn)(void *), process_t *proc) {
+    if (proc->use_namespaces && ns_start_pid_namespace(&proc->ns) == -1)
+        return -1;
+    pid_t pid = saferun_clone(fn, proc, get_clone_flags(proc));
+    if (proc->use_namespaces)
+        ns_leave_pid_namespace();
+    return pid;
+}
+
+/*
+ * Pool of children which are already cloned and jailed (enter_jail is done),
+ * parked on a socket until they get the rest of process_t with the program to run.
+ * Claiming a child costs only start_program: limits, privileges drop, redirects, seccomp and exec.
+ *
+ * Instructions are: uint32 length, limits_t, rlimits_t, placement_t, use_seccomp, seccomp filter if it is used
+ * (uint16 length + BPF program, child can be cloned before profile is compiled), capture flag,
+ * mask of passed fds, then strings chdir, stdin, stdout, stderr and argv, every one is
+ * a presence byte + NUL-terminated string. Passed fds (cached stdin, pipes of --interactor
+ * and of captured streams) follow as SCM_RIGHTS.
+ */
+
+struct pooled_t {
+    pid_t pid;
+    int fd; /**< parent's end of socketpair */
+    namespaces_t ns; /**< namespaces child is in, they are passed to the process on claim */
+    int scratch_fd;  /**< tmpfs of child's jail, passed to the process on claim too */
+};
+
+/* Children parked with the same jail, there is one pool for the daemon's jail and one per --image */
+struct child_pool_t {
+    process_t base; /**< jail of the pool, only compatible processes can be claimed */
+    pooled_t *children;
+    int size, count;
+};
+
+static child_pool_t *pools = NULL;
+static int pools_count = 0;
+static int pool_fd = -1; /**< child's end of socketpair, valid only in the pool child */
+
+bool read_full(int fd, void *buf, size_t len) {
+    char *p = (char *) buf;
+    while (len) {
+        ssize_t ret = read(fd, p, len);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        p += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+void pack_str(FILE *stream, const char *str) {
+    fputc(str ? 1 : 0, stream);
+    if (str)
+        fwrite(str, strlen(str) + 1, 1, stream);
+}
+
+char *unpack_str(char **pos, char *end) {
+    if (*pos >= end || !*(*pos)++)
+        return NULL;
+    char *str = *pos;
+    *pos += strnlen(str, end - str) + 1;
+    return str;
+}
+
+/* Fds the child gets from the parent instead of opening files: stdin, stdout, captured stdout and stderr */
+#define RUN_FDS 4
+
+void get_run_fds(const process_t *proc, int *fds) {
+    fds[0] = proc->stdin_fd;
+    fds[1] = proc->stdout_fd;
+    fds[2] = proc->out.write_fd;
+    fds[3] = proc->err.write_fd;
+}
+
+/* Bit i is set if fds[i] is passed */
+int run_fds_mask(const process_t *proc) {
+    int fds[RUN_FDS], mask = 0;
+    get_run_fds(proc, fds);
+    for (int i = 0; i < RUN_FDS; ++i)
+        if (fds[i] != -1)
+            mask |= 1 << i;
+    return mask;
+}
+
+/* Passes fds of run_fds_mask() as SCM_RIGHTS. @return -1 on error */
+int send_run_fds(int fd, const process_t *proc) {
+    int fds[RUN_FDS], passed[RUN_FDS], count = 0;
+    get_run_fds(proc, fds);
+    for (int i = 0; i < RUN_FDS; ++i)
+        if (fds[i] != -1)
+            passed[count++] = fds[i];
+    if (!count)
+        return 0;
+
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+    char control[CMSG_SPACE(sizeof(passed))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), passed, count * sizeof(int));
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+int receive_run_fds(int fd, process_t *proc, int mask) {
+    int fds[RUN_FDS] = { -1, -1, -1, -1 }, passed[RUN_FDS], count = 0;
+    for (int i = 0; i < RUN_FDS; ++i)
+        if (mask & (1 << i))
+            ++count;
+
+    if (count) {
+        char byte;
+        struct iovec iov = { &byte, 1 };
+        char control[CMSG_SPACE(sizeof(passed))];
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr *cmsg;
+        if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != 1 || !(cmsg = CMSG_FIRSTHDR(&msg))
+                || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(count * sizeof(int)))
+            return -1;
+        memcpy(passed, CMSG_DATA(cmsg), count * sizeof(int));
+
+        for (int i = 0, j = 0; i < RUN_FDS; ++i)
+            if (mask & (1 << i))
+                fds[i] = passed[j++];
+    }
+
+    proc->stdin_fd = fds[0];
+    proc->stdout_fd = fds[1];
+    proc->out.write_fd = fds[2];
+    proc->err.write_fd = fds[3];
+    return 0;
+}
+
+/* In pool child, fills proc with instructions from the parent. @return -1 if parent gave up on us */
+int receive_instructions(process_t *proc) {
+    uint32_t len;
+    if (!read_full(pool_fd, &len, sizeof(len)))
+        return -1;
+
+    char *buf = (char *) malloc(len + 1);
+    if (!read_full(pool_fd, buf, len))
+        return -1;
+    buf[len] = '\0';
+
+    char *pos = buf, *end = buf + len;
+    memcpy(&proc->limits, pos, sizeof(limits_t));
+    pos += sizeof(limits_t);
+    memcpy(&proc->jail.rlimits, pos, sizeof(rlimits_t));
+    pos += sizeof(rlimits_t);
+    memcpy(&proc->placement, pos, sizeof(placement_t));
+    pos += sizeof(placement_t);
+    proc->use_seccomp = *pos++;
+    if (proc->use_seccomp) {
+        struct sock_fprog *filter = (struct sock_fprog *) malloc(sizeof(struct sock_fprog));
+        memcpy(&filter->len, pos, sizeof(filter->len));
+        pos += sizeof(filter->len);
+        filter->filter = (struct sock_filter *) pos;
+        pos += filter->len * sizeof(struct sock_filter);
+        proc->seccomp_filter = filter;
+    }
+    proc->capture = *pos++;
+    int fds_mask = *pos++;
+    proc->jail.chdir = unpack_str(&pos, end);
+    proc->redirect_stdin = unpack_str(&pos, end);
+    proc->redirect_stdout = unpack_str(&pos, end);
+    proc->redirect_stderr = unpack_str(&pos, end);
+
+    int argc = 0;
+    proc->argv = (char **) malloc(sizeof(char *));
+    while (pos < end) {
+        proc->argv = (char **) realloc(proc->argv, (argc + 2) * sizeof(char *));
+        proc->argv[argc++] = unpack_str(&pos, end);
+    }
+    proc->argv[argc] = NULL;
+
+    capture_init(proc);
+    if (receive_run_fds(pool_fd, proc, fds_mask) == -1)
+        return -1;
+    close(pool_fd);
+    return 0;
+}
+
+int send_instructions(int fd, const process_t *proc) {
+    char *buf = NULL;
+    size_t buf_len = 0;
+    FILE *stream = open_memstream(&buf, &buf_len);
+    uint32_t len = 0;
+    fwrite(&len, sizeof(len), 1, stream); //placeholder
+    fwrite(&proc->limits, sizeof(limits_t), 1, stream);
+    fwrite(&proc->jail.rlimits, sizeof(rlimits_t), 1, stream);
+    fwrite(&proc->placement, sizeof(placement_t), 1, stream);
+    fputc(proc->use_seccomp, stream);
+    if (proc->use_seccomp) {
+        fwrite(&proc->seccomp_filter->len, sizeof(proc->seccomp_filter->len), 1, stream);
+        fwrite(proc->seccomp_filter->filter, sizeof(struct sock_filter), proc->seccomp_filter->len, stream);
+    }
+    fputc(proc->capture, stream);
+    fputc(run_fds_mask(proc), stream);
+    pack_str(stream, proc->jail.chdir);
+    pack_str(stream, proc->redirect_stdin);
+    pack_str(stream, proc->redirect_stdout);
+    pack_str(stream, proc->redirect_stderr);
+    for (char **arg = proc->argv; *arg; ++arg)
+        pack_str(stream, *arg);
+    fclose(stream);
+
+    len = buf_len - sizeof(len);
+    memcpy(buf, &len, sizeof(len));
+
+    size_t sent = 0;
+    while (sent < buf_len) {
+        ssize_t ret = send(fd, buf + sent, buf_len - sent, MSG_NOSIGNAL);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        sent += ret;
+    }
+    free(buf);
+    return sent == buf_len ? 0 : -1;
+}
+
+/* Closes all fds above stderr except keep_a and keep_b, -1 is nothing to keep */
+void close_other_fds(int keep_a, int keep_b) {
+    int keep[2] = { keep_a < keep_b ? keep_a : keep_b, keep_a < keep_b ? keep_b : keep_a };
+    int from = 3;
+    for (int i = 0; i < 2; ++i) {
+        if (keep[i] < from) // -1, stdio or the same fd twice
+            continue;
+        if (keep[i] > from)
+            syscall(SYS_close_range, from, keep[i] - 1, 0);
+        from = keep[i] + 1;
+    }
+    syscall(SYS_close_range, from, ~0U, 0);
+}
+
+int do_start_pooled(void *_data) {
+    process_t *proc = (process_t *) _data;
+    ns_enter(&proc->ns);
+    int null_fd = enter_jail(proc);
+    // parked child must not hold copies of fds of the daemon, e.g. sockets of clients and pipes of other runs
+    close_other_fds(pool_fd, null_fd);
+    if (receive_instructions(proc) == -1)
+        _exit(1);
+    return start_program(proc, null_fd);
+}
+
+/* Children are parked with the jail of base, pools are used by spawn_process for compatible processes */
+void pool_init(const process_t *base, int size) {
+    pools = (child_pool_t *) realloc(pools, (pools_count + 1) * sizeof(child_pool_t));
+    child_pool_t *pool = &pools[pools_count++];
+    pool->base = *base;
+    cgroup_init(&pool->base.cgroup); //pooled child is moved into cgroup on claim
+    ns_init(&pool->base.ns);
+    pool->base.scratch_fd = -1;
+    perf_init(&pool->base.perf);
+    pool->children = (pooled_t *) malloc(size * sizeof(pooled_t));
+    pool->size = size;
+    pool->count = 0;
+}
+
+bool pool_full() {
+    for (int i = 0; i < pools_count; ++i)
+        if (pools[i].count < pools[i].size)
+            return false;
+    return true;
+}
+
+/** Adds one parked child to the first pool which isn't full. @return -1 on error */
+int pool_refill_one() {
+    child_pool_t *pool = NULL;
+    for (int i = 0; i < pools_count && !pool; ++i)
+        if (pools[i].count < pools[i].size)
+            pool = &pools[i];
+    if (!pool)
+        return 0;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+        SYSERROR("can't create socketpair for pool");
+        return -1;
+    }
+
+    process_t *base = &pool->base;
+    if (base->use_namespaces && ns_pool_enabled() && ns_acquire(&base->ns) == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    pool_fd = fds[1];
+    base->scratch_fd = create_scratch(&base->jail);
+    pid_t pid = clone_jailed(do_start_pooled, base);
+    pool_fd = -1;
+    close(fds[1]);
+    namespaces_t ns = base->ns;
+    ns_init(&base->ns);
+    int scratch_fd = base->scratch_fd;
+    base->scratch_fd = -1;
+
+    if (pid < 0) {
+        SYSERROR("Failed to clone pooled child, pool is shrunk to %d", pool->count);
+        close(fds[0]);
+        if (scratch_fd != -1)
+            close(scratch_fd);
+        ns_release(&ns);
+        pool->size = pool->count; //don't try again and again
+        return -1;
+    }
+
+    pool->children[pool->count].pid = pid;
+    pool->children[pool->count].fd = fds[0];
+    pool->children[pool->count].ns = ns;
+    pool->children[pool->count].scratch_fd = scratch_fd;
+    ++pool->count;
+    TRACE("pooled child %d, %d in pool of %s", pid, pool->count, base->jail.chroot ? base->jail.chroot : "/");
+    return 0;
+}
+
+bool same_str(const char *a, const char *b) {
+    return (!a && !b) || (a && b && !strcmp(a, b));
+}
+
+/* Jail of a pooled child is already set up, it must be the one process wants */
+bool pool_compatible(const child_pool_t *pool, const process_t *proc) {
+    const jail_t *a = &proc->jail, *b = &pool->base.jail;
+    bool same_jail = same_str(a->chroot, b->chroot) && a->mount_ns == b->mount_ns
+            && a->overlay == b->overlay && a->scratch == b->scratch;
+    return same_jail && proc->use_namespaces == pool->base.use_namespaces && !proc->syscall_profile;
+}
+
+void discard_pooled(pooled_t *child) {
+    close(child->fd);
+    kill(child->pid, SIGKILL);
+    waitpid(child->pid, NULL, 0);
+    ns_release(&child->ns);
+    if (child->scratch_fd != -1)
+        close(child->scratch_fd);
+}
+
+/** Hands process to a pooled child. @return -1 if there is no suitable child */
+int claim_pooled(process_t *proc) {
+    child_pool_t *pool = NULL;
+    for (int i = 0; i < pools_count && !pool; ++i)
+        if (pool_compatible(&pools[i], proc))
+            pool = &pools[i];
+    if (!pool)
+        return -1;
+
+    while (pool->count) {
+        pooled_t child = pool->children[--pool->count];
+
+        if (proc->cgroup.path && cgroup_attach(&proc->cgroup, child.pid) == -1) {
+            discard_pooled(&child);
+            return -1;
+        }
+
+        // child waits for instructions, so counters are opened before its exec
+        if (proc->use_perf)
+            perf_open(&proc->perf, child.pid, proc->limits.instructions);
+
+        if (send_instructions(child.fd, proc) == -1 || send_run_fds(child.fd, proc) == -1) {
+            SYSWARN("pooled child %d is dead", child.pid);
+            discard_pooled(&child);
+            perf_close(&proc->perf);
+            continue;
+        }
+
+        close(child.fd);
+        proc->pid = child.pid;
+        proc->ns = child.ns;
+        proc->scratch_fd = child.scratch_fd;
+        TRACE("claimed pooled child %d, %d left", child.pid, pool->count);
+        return 0;
+    }
+    return -1;
+}
+
+
+/* Child has its copies of fds passed to it, ours would keep pipes from getting EOF */
+void close_run_fds(process_t *proc) {
+    capture_started(proc);
+    if (proc->stdin_fd != -1)
+        close(proc->stdin_fd);
+    if (proc->stdout_fd != -1)
+        close(proc->stdout_fd);
+    proc->stdin_fd = proc->stdout_fd = -1;
+}
+
+int spawn_process(process_t *proc) {
+    cgroup_init(&proc->cgroup);
+    ns_init(&proc->ns);
+    capture_init(proc);
+    proc->placement.cpu = proc->placement.node = proc->placement.slot = -1;
+    proc->scratch_fd = -1;
+    perf_init(&proc->perf);
+    proc->stats.kill_time = -1;
+    proc->stats.kill_latency = -1;
+    if (proc->syscall_profile) {
+        proc->seccomp_filter = prepare_seccomp(proc->seccomp_profile, true);
+        if (!proc->seccomp_filter || syscall_profile_prepare(proc->syscall_profile) == -1)
+            return -1;
+    } else if (proc->use_seccomp && !(proc->seccomp_filter = prepare_seccomp(proc->seccomp_profile, false))) {
+        return -1;
+    }
+    if (proc->cgroup_root && cgroup_create(&proc->cgroup, proc->cgroup_root, &proc->limits) == -1)
+        return -1;
+    if (capture_prepare(proc) == -1) {
+        release_process(proc);
+        return -1;
+    }
+    if (proc->stdin_fd == -1 && input_cache_enabled() && proc->redirect_stdin && strcmp(proc->redirect_stdin, "null"))
+        proc->stdin_fd = input_cache_open(&proc->jail, proc->redirect_stdin);
+    placement_acquire(&proc->placement);
+
+    if (claim_pooled(proc) == 0) {
+        close_run_fds(proc);
+        return 0;
+    }
+
+    if (proc->use_namespaces && ns_pool_enabled() && ns_acquire(&proc->ns) == -1) {
+        release_process(proc);
+        return -1;
+    }
+
+    if (proc->use_perf && perf_prepare(&proc->perf) == -1) {
+        release_process(proc);
+        return -1;
+    }
+
+    proc->scratch_fd = create_scratch(&proc->jail);
+    proc->pid = clone_jailed(do_start, proc);
 
     if (proc->pid < 0) {
         SYSERROR("Failed to clone");
+        release_process(proc);
+        return -1;
+    }
+    if (proc->use_perf) {
+        perf_open(&proc->perf, proc->pid, proc->limits.instructions);
+        perf_start(&proc->perf);
+    }
+    close_run_fds(proc);
+
+    if (proc->syscall_profile && syscall_profile_attach(proc->syscall_profile, proc->pid) == -1) {
+        reap(proc);
+        release_process(proc);
         return -1;
     }
 
     return 0;
 }
 
-
+/* Frees what spawn_process took for the run, process must be already reaped */
+void release_process(process_t *proc) {
+    cgroup_destroy(&proc->cgroup);
+    ns_release(&proc->ns);
+    if (proc->stats.kill_time != -1) //all processes are gone now
+        proc->stats.kill_latency = get_rtime() - proc->stats.kill_time;
+    if (proc->syscall_profile)
+        syscall_profile_close(proc->syscall_profile);
+    capture_release(proc);
+    close_run_fds(proc);
+    placement_release(&proc->placement);
+    if (proc->scratch_fd != -1)
+        close(proc->scratch_fd);
+    proc->scratch_fd = -1;
+    perf_close(&proc->perf);
+}
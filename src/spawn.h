@@ -17,6 +17,15 @@
 #ifndef SPAWN_H_
 #define SPAWN_H_
 
+#include "process.h"
+
+pid_t saferun_clone(int (*fn)(void *), void *arg, int flags);
 int spawn_process(process_t *proc);
+void release_process(process_t *proc);
+int open_in_jail(const jail_t *jail, const char *filename, int flags);
+
+void pool_init(const process_t *base, int size);
+bool pool_full();
+int pool_refill_one();
 
 #endif /* SPAWN_H_ */
@@ -0,0 +1,396 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "supervisor.h"
+#include "hypervisor.h"
+#include "timer_wheel.h"
+#include "cgroup.h"
+#include "capture.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+/*
+ * Supervisor hypervises many processes in one thread, cost per process
+ * doesn't depend on how many of them are running:
+ *  - exits come from pidfds, all in one epoll;
+ *  - real time deadlines and sampling are timers of one timer wheel (1 tick = 1 ms),
+ *    driven by one timerfd armed for the next non-empty tick;
+ *  - sampling timers are aligned to the sampling period, so all processes are
+ *    sampled in one batch per wakeup;
+ *  - cpu timers of all processes deliver SIGRTMIN to one signalfd, signal value is
+ *    index of the run in the slot table and generation of the slot.
+ *
+ * Epoll can be nested, so supervisor_fd() can be polled by the caller's event loop.
+ */
+
+#define SUPERVISOR_MAX_EVENTS 256
+#define SUPERVISOR_SAMPLE_MS (HYPERVISOR_DELAY / 1000)
+#define SUPERVISOR_SLOT_BITS 20
+#define SUPERVISOR_MAX_SLOTS (1 << SUPERVISOR_SLOT_BITS)
+#define SUPERVISOR_GENERATION_MASK (UINTPTR_MAX >> SUPERVISOR_SLOT_BITS)
+
+enum watch_kind_t {
+    WATCH_TIMER,  /**< timerfd of the timer wheel */
+    WATCH_SIGNAL, /**< signalfd of cpu timers */
+    WATCH_EXIT,   /**< pidfd of a process */
+    WATCH_OOM,    /**< memory.events of process' cgroup */
+    WATCH_STDOUT, /**< pipe of captured stdout */
+    WATCH_STDERR  /**< pipe of captured stderr */
+};
+
+struct supervised_t;
+
+/* What is in epoll_event.data.ptr */
+struct watch_t {
+    watch_kind_t kind;
+    supervised_t *run;
+};
+
+struct supervised_t {
+    process_t *proc;
+    int pidfd;
+    timer_t cpu_timer;
+    bool has_cpu_timer;
+    int slot;     /**< in supervisor_t.slots, -1 if there was no free one */
+    bool exited;
+    wheel_timer_t deadline;
+    wheel_timer_t sample;
+    watch_t exit_watch;
+    watch_t oom_watch;
+    watch_t stdout_watch;
+    watch_t stderr_watch;
+    supervisor_callback_t callback;
+    void *data;
+    supervisor_t *sv;
+};
+
+/* Signal of a deleted cpu timer can still be queued, generation tells that slot was released since */
+struct run_slot_t {
+    supervised_t *run;    /**< NULL if slot is free */
+    uintptr_t generation; /**< incremented on release */
+    int next_free;
+};
+
+struct supervisor_t {
+    int epfd;
+    int timer_fd;
+    int signal_fd;
+    watch_t timer_watch;
+    watch_t signal_watch;
+    timer_wheel_t wheel;
+    long long armed_at; /**< tick timer_fd is armed for, -1 if disarmed */
+    run_slot_t *slots;
+    int slots_size;
+    int free_slot;      /**< head of the list of free slots, -1 if all are used */
+    int count;
+};
+
+bool epoll_add_watch(int epfd, int fd, watch_t *watch) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = watch;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+supervisor_t *supervisor_create() {
+    supervisor_t *sv = (supervisor_t *) malloc(sizeof(supervisor_t));
+    sv->slots = NULL;
+    sv->slots_size = 0;
+    sv->free_slot = -1;
+    sv->count = 0;
+    sv->armed_at = -1;
+    wheel_init(&sv->wheel, get_rtime());
+
+    sv->timer_watch.kind = WATCH_TIMER;
+    sv->timer_watch.run = NULL;
+    sv->signal_watch.kind = WATCH_SIGNAL;
+    sv->signal_watch.run = NULL;
+
+    // Children must not inherit blocked SIGRTMIN, spawn resets signal mask in child
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGRTMIN);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    sv->epfd = epoll_create1(EPOLL_CLOEXEC);
+    sv->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    sv->signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sv->epfd == -1 || sv->timer_fd == -1 || sv->signal_fd == -1
+            || !epoll_add_watch(sv->epfd, sv->timer_fd, &sv->timer_watch)
+            || !epoll_add_watch(sv->epfd, sv->signal_fd, &sv->signal_watch)) {
+        SYSERROR("can't create supervisor");
+        return NULL;
+    }
+    return sv;
+}
+
+int supervisor_fd(const supervisor_t *sv) {
+    return sv->epfd;
+}
+
+int supervisor_count(const supervisor_t *sv) {
+    return sv->count;
+}
+
+void deadline_fired(wheel_timer_t *timer) {
+    supervised_t *run = (supervised_t *) timer->data;
+    check_rtime(&run->proc->stats, &run->proc->limits);
+    if (run->proc->stats.result != _OK)
+        kill_run(run->proc);
+}
+
+void sample_fired(wheel_timer_t *timer) {
+    supervised_t *run = (supervised_t *) timer->data;
+    sample(run->proc);
+
+    // if wheel lags behind, skip missed periods instead of sampling on every tick
+    long long next = timer->expires + SUPERVISOR_SAMPLE_MS;
+    long long now = run->sv->wheel.now;
+    if (next <= now)
+        next = (now / SUPERVISOR_SAMPLE_MS + 1) * SUPERVISOR_SAMPLE_MS;
+    wheel_add(&run->sv->wheel, timer, next);
+}
+
+/* @return index of slot taken by run, -1 if there are too many runs */
+int slot_acquire(supervisor_t *sv, supervised_t *run) {
+    if (sv->free_slot == -1) {
+        if (sv->slots_size == SUPERVISOR_MAX_SLOTS)
+            return -1;
+        int size = sv->slots_size ? 2 * sv->slots_size : 16;
+        sv->slots = (run_slot_t *) realloc(sv->slots, size * sizeof(run_slot_t));
+        for (int i = sv->slots_size; i < size; ++i) {
+            sv->slots[i].run = NULL;
+            sv->slots[i].generation = 0;
+            sv->slots[i].next_free = (i + 1 < size) ? i + 1 : -1;
+        }
+        sv->free_slot = sv->slots_size;
+        sv->slots_size = size;
+    }
+
+    int slot = sv->free_slot;
+    sv->free_slot = sv->slots[slot].next_free;
+    sv->slots[slot].run = run;
+    return slot;
+}
+
+void slot_release(supervisor_t *sv, int slot) {
+    if (slot == -1)
+        return;
+    run_slot_t *s = &sv->slots[slot];
+    s->run = NULL;
+    s->generation = (s->generation + 1) & SUPERVISOR_GENERATION_MASK;
+    s->next_free = sv->free_slot;
+    sv->free_slot = slot;
+}
+
+/* Value of cpu timer signal for run in slot */
+void *slot_key(const supervisor_t *sv, int slot) {
+    return (void *) ((sv->slots[slot].generation << SUPERVISOR_SLOT_BITS) | (uintptr_t) slot);
+}
+
+void rearm_timer(supervisor_t *sv) {
+    long long next = wheel_next(&sv->wheel);
+    if (next == sv->armed_at)
+        return;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (next != -1) {
+        spec.it_value.tv_sec = next / 1000;
+        spec.it_value.tv_nsec = (next % 1000) * 1000000;
+    }
+    if (timerfd_settime(sv->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+        SYSERROR("can't arm supervisor timer");
+    sv->armed_at = next;
+}
+
+/** Starts supervising of spawned process. @return -1 on error, process is killed then */
+int supervisor_add(supervisor_t *sv, process_t *proc, supervisor_callback_t callback, void *data) {
+    init_stats(proc);
+
+    supervised_t *run = (supervised_t *) malloc(sizeof(supervised_t));
+    run->proc = proc;
+    run->callback = callback;
+    run->data = data;
+    run->sv = sv;
+    run->exited = false;
+    run->exit_watch.kind = WATCH_EXIT;
+    run->exit_watch.run = run;
+    run->oom_watch.kind = WATCH_OOM;
+    run->oom_watch.run = run;
+    run->stdout_watch.kind = WATCH_STDOUT;
+    run->stdout_watch.run = run;
+    run->stderr_watch.kind = WATCH_STDERR;
+    run->stderr_watch.run = run;
+
+    run->pidfd = open_pidfd(proc->pid);
+    if (run->pidfd == -1 || !epoll_add_watch(sv->epfd, run->pidfd, &run->exit_watch)) {
+        SYSERROR("can't watch process %d", proc->pid);
+        kill_run(proc);
+        reap(proc);
+        if (run->pidfd != -1)
+            close(run->pidfd);
+        free(run);
+        return -1;
+    }
+
+    if (proc->cgroup.notify_fd != -1 && !epoll_add_watch(sv->epfd, proc->cgroup.notify_fd, &run->oom_watch))
+        SYSWARN("can't add memory.events to epoll"); //not a critical, oom is still checked when sampling
+
+    if ((proc->out.read_fd != -1 && !epoll_add_watch(sv->epfd, proc->out.read_fd, &run->stdout_watch))
+            || (proc->err.read_fd != -1 && !epoll_add_watch(sv->epfd, proc->err.read_fd, &run->stderr_watch))) {
+        SYSERROR("can't add output pipe to epoll");
+        kill_run(proc); //would hang on full pipe, exit is still noticed
+    }
+
+    run->slot = slot_acquire(sv, run);
+    run->has_cpu_timer = run->slot != -1
+        && create_cpu_timer(proc, SIGRTMIN, slot_key(sv, run->slot), &run->cpu_timer);
+
+    if (!sv->wheel.count) //wheel may be idle for long, don't make it go through all the ticks
+        wheel_init(&sv->wheel, get_rtime());
+
+    // +1 ms because check_rtime() treats reaching the limit exactly as OK
+    wheel_timer_init(&run->deadline, deadline_fired, run);
+    wheel_add(&sv->wheel, &run->deadline, proc->stats.start_time + proc->limits.real_time + 1);
+
+    // aligned, so all processes are sampled at the same ticks
+    long long first_sample = (proc->stats.start_time / SUPERVISOR_SAMPLE_MS + 1) * SUPERVISOR_SAMPLE_MS;
+    wheel_timer_init(&run->sample, sample_fired, run);
+    wheel_add(&sv->wheel, &run->sample, first_sample);
+
+    ++sv->count;
+
+    rearm_timer(sv);
+    TRACE("supervising process %d, %d in total", proc->pid, sv->count);
+    return 0;
+}
+
+void finish_run(supervisor_t *sv, supervised_t *run) {
+    wheel_del(&sv->wheel, &run->deadline);
+    wheel_del(&sv->wheel, &run->sample);
+    if (run->has_cpu_timer)
+        timer_delete(run->cpu_timer);
+    slot_release(sv, run->slot);
+    // pooled children may hold copies of pidfd, so close() alone won't remove it from epoll
+    epoll_ctl(sv->epfd, EPOLL_CTL_DEL, run->pidfd, NULL);
+    close(run->pidfd);
+    if (run->proc->cgroup.notify_fd != -1)
+        epoll_ctl(sv->epfd, EPOLL_CTL_DEL, run->proc->cgroup.notify_fd, NULL);
+    drain_output(run->proc);
+    if (run->proc->out.read_fd != -1)
+        epoll_ctl(sv->epfd, EPOLL_CTL_DEL, run->proc->out.read_fd, NULL);
+    if (run->proc->err.read_fd != -1)
+        epoll_ctl(sv->epfd, EPOLL_CTL_DEL, run->proc->err.read_fd, NULL);
+
+    --sv->count;
+
+    reap(run->proc);
+    run->callback(run->proc, run->data);
+    free(run);
+}
+
+/* @return run the cpu timer signal is for, NULL if its slot was released since the signal */
+supervised_t *find_run(supervisor_t *sv, uintptr_t key) {
+    int slot = key & (SUPERVISOR_MAX_SLOTS - 1);
+    if (slot >= sv->slots_size)
+        return NULL;
+    run_slot_t *s = &sv->slots[slot];
+    return (s->run && s->generation == key >> SUPERVISOR_SLOT_BITS) ? s->run : NULL;
+}
+
+void handle_cpu_timers(supervisor_t *sv) {
+    struct signalfd_siginfo info;
+    while (read(sv->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        supervised_t *run = find_run(sv, (uintptr_t) info.ssi_ptr);
+        if (run && !run->exited)
+            sample(run->proc);
+    }
+}
+
+void process_events(supervisor_t *sv, int timeout) {
+    struct epoll_event events[SUPERVISOR_MAX_EVENTS];
+    supervised_t *exited[SUPERVISOR_MAX_EVENTS];
+    int exited_count = 0;
+
+    int n = epoll_wait(sv->epfd, events, SUPERVISOR_MAX_EVENTS, timeout);
+    if (n == -1 && errno != EINTR)
+        SYSERROR("epoll_wait failed");
+
+    for (int i = 0; i < n; ++i) {
+        watch_t *watch = (watch_t *) events[i].data.ptr;
+        switch (watch->kind) {
+            case WATCH_TIMER: {
+                uint64_t expirations;
+                if (read(sv->timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+                    SYSWARN("can't read timerfd");
+                sv->armed_at = -1;
+                break;
+            }
+            case WATCH_SIGNAL:
+                handle_cpu_timers(sv);
+                break;
+            case WATCH_EXIT:
+                // finished after all events are handled, other events may refer to this run
+                watch->run->exited = true;
+                exited[exited_count++] = watch->run;
+                break;
+            case WATCH_OOM: {
+                process_t *proc = watch->run->proc;
+                cgroup_consume_events(&proc->cgroup);
+                check_oom(&proc->stats, &proc->cgroup);
+                if (proc->stats.result != _OK)
+                    kill_run(proc);
+                break;
+            }
+            case WATCH_STDOUT:
+            case WATCH_STDERR: {
+                process_t *proc = watch->run->proc;
+                capture_t *c = (watch->kind == WATCH_STDOUT) ? &proc->out : &proc->err;
+                if (!capture_drain(proc, c))
+                    epoll_ctl(sv->epfd, EPOLL_CTL_DEL, c->read_fd, NULL);
+                if (proc->stats.result != _OK)
+                    kill_run(proc);
+                break;
+            }
+        }
+    }
+
+    wheel_advance(&sv->wheel, get_rtime());
+
+    for (int i = 0; i < exited_count; ++i)
+        finish_run(sv, exited[i]);
+
+    rearm_timer(sv);
+}
+
+/* Handles events which are ready, doesn't block */
+void supervisor_dispatch(supervisor_t *sv) {
+    process_events(sv, 0);
+}
+
+/* Blocks until some events come and handles them */
+void supervisor_wait(supervisor_t *sv) {
+    process_events(sv, -1);
+}
@@ -0,0 +1,34 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef SUPERVISOR_H_
+#define SUPERVISOR_H_
+
+#include "process.h"
+
+/* Called when process has terminated and its stats are final */
+typedef void (*supervisor_callback_t)(process_t *proc, void *data);
+
+struct supervisor_t;
+
+supervisor_t *supervisor_create();
+int supervisor_fd(const supervisor_t *sv);
+int supervisor_count(const supervisor_t *sv);
+int supervisor_add(supervisor_t *sv, process_t *proc, supervisor_callback_t callback, void *data);
+void supervisor_dispatch(supervisor_t *sv);
+void supervisor_wait(supervisor_t *sv);
+
+#endif /* SUPERVISOR_H_ */
@@ -0,0 +1,196 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "syscall_profile.h"
+#include "hypervisor.h"
+#include "log.h"
+
+#include <seccomp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
+/*
+ * Syscall profiling (--syscall-profile): instead of killing the process, filter of the profile
+ * returns SECCOMP_RET_USER_NOTIF for syscalls outside of the profile. Parent counts them and lets
+ * them go on (SECCOMP_USER_NOTIF_FLAG_CONTINUE), syscalls of the profile run at native speed.
+ * Nothing is enforced in this mode, it is for finding out what a runtime needs.
+ *
+ * Listener fd is created in child, so parent takes it with pidfd_getfd(). Child can't send it:
+ * sendmsg() would be notified itself while nobody listens yet. So before installing the filter
+ * child sends the number the listener will get, which is the lowest free fd. Then child waits
+ * for parent's ack before exec, listener is close-on-exec and without it syscalls fail with ENOSYS.
+ */
+
+int syscall_profile_prepare(syscall_profile_t *profile) {
+    profile->notify_fd = -1;
+    profile->handshake_done = false;
+    profile->first_unlisted = -1;
+    memset(profile->hits, 0, sizeof(profile->hits));
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, profile->sock) == -1) {
+        SYSERROR("can't create socketpair for syscall profiling");
+        return -1;
+    }
+    return 0;
+}
+
+/* Called in child instead of setup_seccomp() */
+void syscall_profile_install(syscall_profile_t *profile, const struct sock_fprog *filter) {
+    close(profile->sock[0]);
+
+    int fd = dup(STDIN_FILENO); //nothing opens fds between this and seccomp(), so listener gets the same
+    if (fd == -1)
+        fd = open("/dev/null", O_RDONLY);
+    close(fd);
+    if (write(profile->sock[1], &fd, sizeof(fd)) != sizeof(fd)) {
+        SYSERROR("can't send listener fd to parent");
+        abort();
+    }
+
+    int listener = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER, filter);
+    if (listener != fd) //can't even complain, write() may be not in the profile
+        abort();
+
+    char ack;
+    if (read(profile->sock[1], &ack, 1) != 1)
+        abort();
+}
+
+void syscall_profile_close(syscall_profile_t *profile) {
+    if (profile->sock[0] != -1) close(profile->sock[0]);
+    if (profile->sock[1] != -1) close(profile->sock[1]);
+    if (profile->notify_fd != -1) close(profile->notify_fd);
+    profile->sock[0] = profile->sock[1] = profile->notify_fd = -1;
+}
+
+/** Takes listener of spawned child. @return -1 on error, child is killed then */
+int syscall_profile_attach(syscall_profile_t *profile, pid_t pid) {
+    profile->handshake_fd = profile->sock[1];
+    close(profile->sock[1]);
+    profile->sock[1] = -1;
+
+    int fd, pidfd = -1;
+    ssize_t len;
+    while ((len = read(profile->sock[0], &fd, sizeof(fd))) == -1 && errno == EINTR)
+        ;
+    if (len != sizeof(fd)) {
+        ERROR("Child died before installing seccomp listener");
+        goto err;
+    }
+
+    pidfd = open_pidfd(pid);
+    if (pidfd == -1) {
+        SYSERROR("can't open pidfd, syscall profiling needs Linux 5.6");
+        goto err;
+    }
+
+    // EBADF means child has not installed the filter yet, it is the very next thing it does.
+    // Pidfd is readable once child exits, e.g. killed before it got there, then EBADF is forever
+    struct pollfd pfd;
+    pfd.fd = pidfd;
+    pfd.events = POLLIN;
+    while ((profile->notify_fd = syscall(SYS_pidfd_getfd, pidfd, fd, 0)) == -1 && errno == EBADF) {
+        if (poll(&pfd, 1, 0) != 0) {
+            ERROR("Child died before installing seccomp listener");
+            goto err;
+        }
+        sched_yield();
+    }
+    if (profile->notify_fd == -1) {
+        SYSERROR("can't get seccomp listener of child");
+        goto err;
+    }
+    fcntl(profile->notify_fd, F_SETFD, FD_CLOEXEC);
+
+    if (write(profile->sock[0], "", 1) != 1) {
+        SYSERROR("can't let child go on");
+        goto err;
+    }
+
+    close(pidfd);
+    close(profile->sock[0]);
+    profile->sock[0] = -1;
+    return 0;
+
+err:
+    if (pidfd != -1)
+        close(pidfd);
+    kill(pid, SIGKILL);
+    syscall_profile_close(profile);
+    return -1;
+}
+
+/* Counts one notified syscall and lets it run */
+void syscall_profile_handle(syscall_profile_t *profile) {
+    struct seccomp_notif req;
+    struct seccomp_notif_resp resp;
+    memset(&req, 0, sizeof(req));
+    if (ioctl(profile->notify_fd, SECCOMP_IOCTL_NOTIF_RECV, &req) == -1)
+        return; //process may be already dead
+
+    if (!profile->handshake_done && req.data.nr == SYS_read && (int) req.data.args[0] == profile->handshake_fd) {
+        profile->handshake_done = true;
+    } else if (req.data.nr >= 0 && req.data.nr < SYSCALL_PROFILE_MAX_NR) {
+        ++profile->hits[req.data.nr];
+        if (profile->first_unlisted == -1)
+            profile->first_unlisted = req.data.nr;
+    }
+
+    memset(&resp, 0, sizeof(resp));
+    resp.id = req.id;
+    resp.flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+    if (ioctl(profile->notify_fd, SECCOMP_IOCTL_NOTIF_SEND, &resp) == -1 && errno != ENOENT)
+        SYSWARN("can't let syscall %d go on", req.data.nr);
+}
+
+void print_syscall(FILE *stream, const char *prefix, int nr, unsigned long hits) {
+    char *name = seccomp_syscall_resolve_num_arch(SCMP_ARCH_NATIVE, nr);
+    if (name)
+        fprintf(stream, "%s %s %lu\n", prefix, name, hits);
+    else
+        fprintf(stream, "%s %d %lu\n", prefix, nr, hits);
+    free(name);
+}
+
+/* Syscalls outside of profile, most used first */
+void syscall_profile_print(FILE *stream, const syscall_profile_t *profile) {
+    if (profile->first_unlisted == -1) {
+        fprintf(stream, "SRUN_SYSCALL_FIRST: none\n");
+        return;
+    }
+    print_syscall(stream, "SRUN_SYSCALL_FIRST:", profile->first_unlisted, profile->hits[profile->first_unlisted]);
+
+    bool printed[SYSCALL_PROFILE_MAX_NR];
+    memset(printed, 0, sizeof(printed));
+    while (1) {
+        int best = -1;
+        for (int nr = 0; nr < SYSCALL_PROFILE_MAX_NR; ++nr)
+            if (profile->hits[nr] && !printed[nr] && (best == -1 || profile->hits[nr] > profile->hits[best]))
+                best = nr;
+        if (best == -1)
+            break;
+        printed[best] = true;
+        print_syscall(stream, "SRUN_SYSCALL:", best, profile->hits[best]);
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef SYSCALL_PROFILE_H_
+#define SYSCALL_PROFILE_H_
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define SYSCALL_PROFILE_MAX_NR 1024
+
+/* Syscalls made by the program which are not in its seccomp profile */
+struct syscall_profile_t {
+    int sock[2];          /**< child tells parent fd number of its seccomp listener */
+    int notify_fd;        /**< parent's copy of the listener, -1 if not attached */
+    int handshake_fd;     /**< child's end of socketpair, child's read of ack is notified too, it is not counted */
+    bool handshake_done;
+    int first_unlisted;   /**< syscall which would be SV with the real filter, -1 if none */
+    unsigned long hits[SYSCALL_PROFILE_MAX_NR];
+};
+
+struct sock_fprog;
+
+int syscall_profile_prepare(syscall_profile_t *profile);
+void syscall_profile_install(syscall_profile_t *profile, const struct sock_fprog *filter);
+int syscall_profile_attach(syscall_profile_t *profile, pid_t pid);
+void syscall_profile_handle(syscall_profile_t *profile);
+void syscall_profile_close(syscall_profile_t *profile);
+void syscall_profile_print(FILE *stream, const syscall_profile_t *profile);
+
+#endif /* SYSCALL_PROFILE_H_ */
@@ -0,0 +1,150 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "timer_wheel.h"
+
+#include <stddef.h>
+
+/*
+ * Level L keeps timers which expire in less than 64^(L+1) ticks from now,
+ * slot is chosen by the L-th group of 6 bits of expiration tick.
+ * Every time the lower level wraps around, one slot of the upper level
+ * is cascaded down, so every timer is moved at most WHEEL_LEVELS-1 times.
+ */
+
+void list_init(wheel_timer_t *head) {
+    head->prev = head->next = head;
+}
+
+void list_add(wheel_timer_t *head, wheel_timer_t *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+void list_del(wheel_timer_t *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+}
+
+void wheel_init(timer_wheel_t *wheel, long long now) {
+    wheel->now = now;
+    wheel->count = 0;
+    for (int level = 0; level < WHEEL_LEVELS; ++level)
+        for (int i = 0; i < WHEEL_SIZE; ++i)
+            list_init(&wheel->slots[level][i]);
+}
+
+void wheel_timer_init(wheel_timer_t *timer, wheel_callback_t callback, void *data) {
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->data = data;
+    timer->prev = timer->next = NULL;
+}
+
+void place_timer(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    long long expires = timer->expires;
+    if (expires <= wheel->now) // already expired, fire on the next tick
+        expires = wheel->now + 1;
+
+    long long delta = expires - wheel->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1LL << (WHEEL_BITS * (level + 1))))
+        ++level;
+
+    // too far in the future, it will be placed again when the last level is cascaded
+    if (delta >= (1LL << (WHEEL_BITS * WHEEL_LEVELS)))
+        expires = wheel->now + (1LL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+    int slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    list_add(&wheel->slots[level][slot], timer);
+}
+
+void wheel_add(timer_wheel_t *wheel, wheel_timer_t *timer, long long expires) {
+    if (timer->next)
+        wheel_del(wheel, timer);
+
+    timer->expires = expires;
+    place_timer(wheel, timer);
+    ++wheel->count;
+}
+
+void wheel_del(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    if (!timer->next)
+        return;
+    list_del(timer);
+    --wheel->count;
+}
+
+/* Moves all timers of the slot to lower levels */
+void cascade(timer_wheel_t *wheel, int level, int slot) {
+    wheel_timer_t list;
+    wheel_timer_t *head = &wheel->slots[level][slot];
+    if (head->next == head)
+        return;
+
+    // detach whole slot first, timers may be placed back into the same slot
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = list.prev->next = &list;
+    list_init(head);
+
+    while (list.next != &list) {
+        wheel_timer_t *timer = list.next;
+        list_del(timer);
+        if (timer->expires <= wheel->now) // expires right at the tick being processed
+            list_add(&wheel->slots[0][wheel->now & WHEEL_MASK], timer);
+        else
+            place_timer(wheel, timer);
+    }
+}
+
+/* Fires every timer expired up to now, callbacks may add and delete timers */
+void wheel_advance(timer_wheel_t *wheel, long long now) {
+    while (wheel->now < now) {
+        long long tick = ++wheel->now;
+
+        for (int level = 1; level < WHEEL_LEVELS; ++level) {
+            if ((tick >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK) // lower level hasn't wrapped
+                break;
+            cascade(wheel, level, (tick >> (WHEEL_BITS * level)) & WHEEL_MASK);
+        }
+
+        wheel_timer_t *head = &wheel->slots[0][tick & WHEEL_MASK];
+        while (head->next != head) {
+            wheel_timer_t *timer = head->next;
+            wheel_del(wheel, timer);
+            timer->callback(timer);
+        }
+    }
+}
+
+/** @return tick to wake up at for the next call of wheel_advance, -1 if there are no timers */
+long long wheel_next(const timer_wheel_t *wheel) {
+    if (!wheel->count)
+        return -1;
+
+    // timers of the upper levels can't fire earlier than the next cascade
+    long long boundary = ((wheel->now >> WHEEL_BITS) + 1) << WHEEL_BITS;
+    for (long long tick = wheel->now + 1; tick < boundary; ++tick) {
+        const wheel_timer_t *head = &wheel->slots[0][tick & WHEEL_MASK];
+        if (head->next != head)
+            return tick;
+    }
+    return boundary;
+}
@@ -0,0 +1,50 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4 /**< with 1 ms ticks covers 64^4 ms, about 4.6 hours */
+
+struct wheel_timer_t;
+typedef void (*wheel_callback_t)(wheel_timer_t *timer);
+
+/* Intrusive timer, embed it into the object it belongs to */
+struct wheel_timer_t {
+    long long expires;          /**< tick */
+    wheel_callback_t callback;
+    void *data;
+    wheel_timer_t *prev, *next; /**< NULL if timer is not armed */
+};
+
+/* Hierarchical timing wheel: add, delete and firing of a timer are O(1) */
+struct timer_wheel_t {
+    long long now;              /**< current tick, all timers up to it have fired */
+    int count;                  /**< armed timers */
+    wheel_timer_t slots[WHEEL_LEVELS][WHEEL_SIZE]; /**< heads of circular lists */
+};
+
+void wheel_init(timer_wheel_t *wheel, long long now);
+void wheel_timer_init(wheel_timer_t *timer, wheel_callback_t callback, void *data);
+void wheel_add(timer_wheel_t *wheel, wheel_timer_t *timer, long long expires);
+void wheel_del(timer_wheel_t *wheel, wheel_timer_t *timer);
+void wheel_advance(timer_wheel_t *wheel, long long now);
+long long wheel_next(const timer_wheel_t *wheel);
+
+#endif /* TIMER_WHEEL_H_ */
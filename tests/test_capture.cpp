@@ -0,0 +1,156 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include "test.h"
+#include "capture.h"
+#include "spawn.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/* Redirects to files aren't tested here, capture_prepare isn't called */
+int open_in_jail(const jail_t *jail, const char *filename, int flags) {
+    return -1;
+}
+
+/* Captured stdout of a run: data written to in_fd is drained to out_fd */
+struct pipes_t {
+    int in_fd;
+    int out_fd;
+};
+
+void start(process_t *proc, pipes_t *p, bool hash, long limit_kb) {
+    memset(proc, 0, sizeof(*proc));
+    capture_init(proc);
+    proc->capture = true;
+    proc->output_hash = hash;
+    proc->limits.output = limit_kb;
+    proc->stats.output_hash = 14695981039346656037ULL;
+    proc->stats.result = _OK;
+
+    int src[2], dest[2];
+    if (pipe2(src, O_CLOEXEC) == -1 || pipe2(dest, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        _exit(2);
+    }
+    fcntl(src[0], F_SETFL, O_NONBLOCK);
+    fcntl(dest[0], F_SETFL, O_NONBLOCK);
+    proc->out.read_fd = src[0];
+    proc->out.dest_fd = dest[1];
+    p->in_fd = src[1];
+    p->out_fd = dest[0];
+}
+
+void finish(process_t *proc, pipes_t *p) {
+    if (p->in_fd != -1)
+        close(p->in_fd);
+    close(p->out_fd);
+    capture_release(proc);
+}
+
+void put(pipes_t *p, const char *data, size_t len) {
+    CHECK_EQ(write(p->in_fd, data, len), (long long) len);
+}
+
+/* @return bytes that reached destination */
+long long take(pipes_t *p, char *buf, size_t size) {
+    ssize_t ret = read(p->out_fd, buf, size);
+    return ret == -1 ? 0 : ret;
+}
+
+/* FNV-1a of stdout must match what clients compute for the expected output, however it's split */
+void test_hash() {
+    process_t proc;
+    pipes_t p;
+    char buf[16];
+
+    start(&proc, &p, true, 0);
+    CHECK(capture_drain(&proc, &proc.out)); // nothing written yet
+    CHECK(proc.stats.output_hash == 0xcbf29ce484222325ULL);
+    put(&p, "a", 1);
+    CHECK(capture_drain(&proc, &proc.out));
+    CHECK(proc.stats.output_hash == 0xaf63dc4c8601ec8cULL);
+    put(&p, "bc", 2);
+    CHECK(capture_drain(&proc, &proc.out));
+    CHECK(proc.stats.output_hash == 0xe71fa2190541574bULL);
+    CHECK_EQ(proc.stats.output, 3);
+    CHECK_EQ(take(&p, buf, sizeof(buf)), 3);
+    CHECK(!memcmp(buf, "abc", 3));
+
+    close(p.in_fd);
+    p.in_fd = -1;
+    CHECK(!capture_drain(&proc, &proc.out)); // EOF
+    CHECK_EQ(proc.stats.result, _OK);
+    finish(&proc, &p);
+}
+
+/* Without hashing data goes by splice, it is counted the same */
+void test_splice() {
+    process_t proc;
+    pipes_t p;
+    char buf[16];
+
+    start(&proc, &p, false, 0);
+    put(&p, "hello", 5);
+    CHECK(capture_drain(&proc, &proc.out));
+    CHECK_EQ(proc.stats.output, 5);
+    CHECK(proc.stats.output_hash == 0xcbf29ce484222325ULL);
+    CHECK_EQ(take(&p, buf, sizeof(buf)), 5);
+    CHECK(!memcmp(buf, "hello", 5));
+    finish(&proc, &p);
+}
+
+/* Exactly the limit is fine, the first byte beyond it is OL and isn't written */
+void test_limit(bool hash) {
+    process_t proc;
+    pipes_t p;
+    char data[1024 + 1], buf[2048];
+    memset(data, 'x', sizeof(data));
+
+    start(&proc, &p, hash, 1);
+    put(&p, data, 1024);
+    CHECK(capture_drain(&proc, &proc.out));
+    CHECK_EQ(proc.stats.output, 1024);
+    CHECK_EQ(proc.stats.result, _OK);
+    if (hash)
+        CHECK(proc.stats.output_hash == 0x51bfc41078b37325ULL);
+
+    put(&p, data, 1);
+    CHECK(!capture_drain(&proc, &proc.out));
+    CHECK_EQ(proc.stats.output, 1024);
+    CHECK_EQ(proc.stats.result, _OL);
+    CHECK_EQ(take(&p, buf, sizeof(buf)), 1024);
+    finish(&proc, &p);
+
+    // more than the limit at once
+    start(&proc, &p, hash, 1);
+    put(&p, data, sizeof(data));
+    CHECK(!capture_drain(&proc, &proc.out));
+    CHECK_EQ(proc.stats.output, 1024);
+    CHECK_EQ(proc.stats.result, _OL);
+    CHECK_EQ(take(&p, buf, sizeof(buf)), 1024);
+    finish(&proc, &p);
+}
+
+int main() {
+    test_hash();
+    test_splice();
+    test_limit(false);
+    test_limit(true);
+    return test_result("capture");
+}
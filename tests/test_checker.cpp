@@ -0,0 +1,94 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "test.h"
+#include "checker.h"
+
+#include <string.h>
+
+/* Output comes in chunks of the pipe, every split must give the same result */
+long long check_split(const char *output, const char *answer, bool exact, size_t chunk) {
+    checker_t checker;
+    checker_init(&checker);
+    checker.expected = answer;
+    checker.size = strlen(answer);
+    checker.exact = exact;
+
+    size_t len = strlen(output);
+    for (size_t pos = 0; pos < len; pos += chunk)
+        checker_feed(&checker, output + pos, len - pos < chunk ? len - pos : chunk);
+    checker_finish(&checker);
+    return checker.mismatch;
+}
+
+/* @return mismatch offset, -2 if it depends on how output is split */
+long long check(const char *output, const char *answer, bool exact) {
+    long long whole = check_split(output, answer, exact, strlen(output) + 1);
+    for (size_t chunk = 1; chunk <= strlen(output); ++chunk)
+        if (check_split(output, answer, exact, chunk) != whole)
+            return -2;
+    return whole;
+}
+
+void test_tokens() {
+    CHECK_EQ(check("1 2 3\n", "1 2 3\n", false), -1);
+    CHECK_EQ(check("1  2\n3", "1 2 3\n", false), -1);
+    CHECK_EQ(check("\t1 2 3", "1 2 3\n\n", false), -1);
+    CHECK_EQ(check("1 2 3\r\n", "1\n2\n3\n", false), -1);
+    CHECK_EQ(check("", "", false), -1);
+    CHECK_EQ(check("\n\n", "  \n", false), -1);
+
+    CHECK_EQ(check("1 2 34\n", "1 2 3\n", false), 5);  // token is longer
+    CHECK_EQ(check("1 2 3\n", "1 2 34\n", false), 5);  // token is shorter
+    CHECK_EQ(check("1 2 4\n", "1 2 3\n", false), 4);
+    CHECK_EQ(check("1 2\n", "1 2 3\n", false), 4);     // output ended too early
+    CHECK_EQ(check("1 2 3 4\n", "1 2 3\n", false), 6); // extra token
+    CHECK_EQ(check("12", "1 2", false), 1);
+    CHECK_EQ(check("x", "", false), 0);
+}
+
+void test_exact() {
+    CHECK_EQ(check("abc\n", "abc\n", true), -1);
+    CHECK_EQ(check("abc", "abc\n", true), 3);
+    CHECK_EQ(check("abd\n", "abc\n", true), 2);
+    CHECK_EQ(check("abc\n\n", "abc\n", true), 4);
+    CHECK_EQ(check("abc \n", "abc\n", true), 3);
+}
+
+/* Identical blocks are skipped by memcmp, difference right after them is still found */
+void test_long_output() {
+    static char answer[10000], output[10000];
+    size_t len = 0;
+    for (int i = 0; i < 1000; ++i)
+        len += sprintf(answer + len, "%d ", i);
+    strcpy(output, answer);
+    CHECK_EQ(check(output, answer, false), -1);
+    CHECK_EQ(check(output, answer, true), -1);
+
+    size_t pos = 3000;
+    while (answer[pos] == ' ')
+        ++pos;
+    output[pos] = answer[pos] == '9' ? '8' : '9';
+    CHECK_EQ(check(output, answer, false), pos);
+    CHECK_EQ(check(output, answer, true), pos);
+}
+
+int main() {
+    test_tokens();
+    test_exact();
+    test_long_output();
+    return test_result("checker");
+}
@@ -0,0 +1,118 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "test.h"
+#include "parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static char *str_value;
+static int int_value;
+static long long_value;
+static int limit_value;
+static bool bool_value;
+
+static parser_option_t options[] = {
+    { "--str",   "-s", PARSER_ARG_STR,   &str_value,   "" },
+    { "--int",   "-i", PARSER_ARG_INT,   &int_value,   "" },
+    { "--long",  "-l", PARSER_ARG_LONG,  &long_value,  "" },
+    { "--limit", "",   PARSER_ARG_LIMIT, &limit_value, "" },
+    { "--bool",  "-b", PARSER_ARG_BOOL,  &bool_value,  "" },
+    { NULL }
+};
+
+/* argv of parse_options starts with program name and ends with NULL */
+int parse(const char *a, const char *b, const char *c = NULL, const char *d = NULL) {
+    char *argv[] = { (char *) "srun2", (char *) a, (char *) b, (char *) c, (char *) d, NULL };
+    int argc = 1;
+    while (argv[argc])
+        ++argc;
+    return parse_options(options, argc, argv);
+}
+
+/* All bits of long are written, not only int of them */
+void test_long() {
+    long_value = -1;
+    CHECK_EQ(parse("--long", "5"), 3);
+    CHECK_EQ(long_value, 5);
+
+    long_value = 0;
+    CHECK_EQ(parse("-l", "-7"), 3);
+    CHECK_EQ(long_value, -7); // negative values are rejected by validation, not by parser
+
+    if (sizeof(long) > sizeof(int)) {
+        CHECK_EQ(parse("--long", "5000000000"), 3);
+        CHECK_EQ(long_value, 5000000000LL);
+    }
+    CHECK_EQ(parse("--long", "0x10"), 3);
+    CHECK_EQ(long_value, 16);
+
+    long_value = 42;
+    CHECK_EQ(parse("--long", "99999999999999999999999"), -1);
+    CHECK_EQ(parse("--long", "12abc"), -1);
+    CHECK_EQ(parse("--long", ""), -1);
+    CHECK_EQ(long_value, 42);
+}
+
+void test_int() {
+    CHECK_EQ(parse("--int", "123"), 3);
+    CHECK_EQ(int_value, 123);
+    CHECK_EQ(parse("-i", "-3"), 3);
+    CHECK_EQ(int_value, -3);
+    CHECK_EQ(parse("--int", "5000000000"), -1);
+    CHECK_EQ(parse("--int", "x"), -1);
+    CHECK_EQ(int_value, -3);
+}
+
+void test_limit() {
+    CHECK_EQ(parse("--limit", "unlimited"), 3);
+    CHECK_EQ(limit_value, PARSER_UNLIMITED);
+    CHECK_EQ(parse("--limit", "0"), 3);
+    CHECK_EQ(limit_value, 0);
+    CHECK_EQ(parse("--limit", "-1"), -1);
+}
+
+void test_bool_and_str() {
+    CHECK_EQ(parse("--bool", "1"), 3);
+    CHECK(bool_value);
+    CHECK_EQ(parse("-b", "off"), 3);
+    CHECK(!bool_value);
+    CHECK_EQ(parse("--bool", "yes"), -1);
+
+    CHECK_EQ(parse("--str", "abc"), 3);
+    CHECK(str_value && !strcmp(str_value, "abc"));
+    free(str_value);
+}
+
+/* Index of the first argument of the command is returned */
+void test_command() {
+    CHECK_EQ(parse("--int", "1", "prog", "arg"), 3);
+    CHECK_EQ(parse("--int", "1", "--", "-prog"), 4);
+    CHECK_EQ(parse("prog", "--int", "2"), 1);
+    CHECK_EQ(int_value, 1);
+    CHECK_EQ(parse("--unknown", "1"), -1);
+    CHECK_EQ(parse("--int", NULL), -1); // no argument
+}
+
+int main() {
+    test_long();
+    test_int();
+    test_limit();
+    test_bool_and_str();
+    test_command();
+    return test_result("parser");
+}
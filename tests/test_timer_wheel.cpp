@@ -0,0 +1,155 @@
+/*
+ *  Copyright 2017 Alexander Ankudinov
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "test.h"
+#include "timer_wheel.h"
+
+/* Timer that remembers when it has fired */
+struct probe_t {
+    wheel_timer_t timer;
+    timer_wheel_t *wheel;
+    long long fired; /**< tick of the last firing, -1 if none */
+    int count;
+    long long period; /**< added again after that many ticks if not 0 */
+};
+
+static timer_wheel_t wheel;
+
+void probe_fired(wheel_timer_t *timer) {
+    probe_t *probe = (probe_t *) timer->data;
+    probe->fired = probe->wheel->now;
+    ++probe->count;
+    if (probe->period)
+        wheel_add(probe->wheel, timer, timer->expires + probe->period);
+}
+
+void probe_init(probe_t *probe, long long period) {
+    wheel_timer_init(&probe->timer, probe_fired, probe);
+    probe->wheel = &wheel;
+    probe->fired = -1;
+    probe->count = 0;
+    probe->period = period;
+}
+
+static const long long starts[] = { 0, 12345, (1LL << 18) - 3 };
+static const long long deltas[] = {
+    0, 1, 2, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, 300001,
+    (1LL << 24) - 1, (1LL << 24) + 1000 // beyond the last level
+};
+#define COUNT(a) (int) (sizeof(a) / sizeof(a[0]))
+
+/* Timer fires exactly at its tick at any level, advancing tick by tick */
+void test_fires_at_tick() {
+    for (int s = 0; s < COUNT(starts); ++s) {
+        for (int d = 0; d < COUNT(deltas); ++d) {
+            long long start = starts[s], expires = start + deltas[d];
+            wheel_init(&wheel, start);
+            probe_t probe;
+            probe_init(&probe, 0);
+            wheel_add(&wheel, &probe.timer, expires);
+
+            long long fire_at = expires > start ? expires : start + 1;
+            for (long long tick = start + 1; tick < fire_at; ++tick)
+                wheel_advance(&wheel, tick);
+            CHECK_EQ(probe.count, 0);
+            wheel_advance(&wheel, fire_at);
+            CHECK_EQ(probe.count, 1);
+            CHECK_EQ(probe.fired, fire_at);
+            CHECK_EQ(wheel.count, 0);
+        }
+    }
+}
+
+/* One advance over many ticks fires timers in order of their ticks */
+void test_advance_jump() {
+    for (int s = 0; s < COUNT(starts); ++s) {
+        wheel_init(&wheel, starts[s]);
+        probe_t probes[COUNT(deltas)];
+        for (int d = 0; d < COUNT(deltas); ++d) {
+            probe_init(&probes[d], 0);
+            wheel_add(&wheel, &probes[d].timer, starts[s] + deltas[d] + 1);
+        }
+        CHECK_EQ(wheel.count, COUNT(deltas));
+        wheel_advance(&wheel, starts[s] + (1LL << 25));
+        for (int d = 0; d < COUNT(deltas); ++d) {
+            CHECK_EQ(probes[d].count, 1);
+            CHECK_EQ(probes[d].fired, starts[s] + deltas[d] + 1);
+        }
+        CHECK_EQ(wheel.count, 0);
+    }
+}
+
+void test_delete() {
+    wheel_init(&wheel, 100);
+    probe_t a, b;
+    probe_init(&a, 0);
+    probe_init(&b, 0);
+    wheel_add(&wheel, &a.timer, 150);
+    wheel_add(&wheel, &b.timer, 5000);
+    wheel_del(&wheel, &a.timer);
+    wheel_del(&wheel, &a.timer); // not armed anymore, nothing happens
+    CHECK_EQ(wheel.count, 1);
+    wheel_add(&wheel, &b.timer, 200); // moved earlier
+    CHECK_EQ(wheel.count, 1);
+    wheel_advance(&wheel, 10000);
+    CHECK_EQ(a.count, 0);
+    CHECK_EQ(b.count, 1);
+    CHECK_EQ(b.fired, 200);
+}
+
+/* Callback adds its timer again, like sampling of supervisor does */
+void test_periodic() {
+    wheel_init(&wheel, 7);
+    probe_t probe;
+    probe_init(&probe, 25);
+    wheel_add(&wheel, &probe.timer, 25);
+    wheel_advance(&wheel, 25 * 1000);
+    CHECK_EQ(probe.count, 1000);
+    CHECK_EQ(probe.fired, 25 * 1000);
+    CHECK_EQ(wheel.count, 1);
+}
+
+void test_next() {
+    wheel_init(&wheel, 1000);
+    CHECK_EQ(wheel_next(&wheel), -1);
+
+    probe_t near, far;
+    probe_init(&near, 0);
+    probe_init(&far, 0);
+    wheel_add(&wheel, &far.timer, 100000);
+    // upper levels aren't searched, wake up at the next cascade
+    CHECK_EQ(wheel_next(&wheel), 1024);
+    wheel_add(&wheel, &near.timer, 1010);
+    CHECK_EQ(wheel_next(&wheel), 1010);
+
+    // following wheel_next never misses a timer
+    while (wheel.count) {
+        long long next = wheel_next(&wheel);
+        CHECK(next > wheel.now);
+        wheel_advance(&wheel, next);
+    }
+    CHECK_EQ(near.fired, 1010);
+    CHECK_EQ(far.fired, 100000);
+}
+
+int main() {
+    test_fires_at_tick();
+    test_advance_jump();
+    test_delete();
+    test_periodic();
+    test_next();
+    return test_result("timer_wheel");
+}